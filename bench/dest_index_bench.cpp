@@ -0,0 +1,133 @@
+// destination index: probe lengths for clustered prefixes and the
+// cost of finding a DV's destinations as the table grows, against
+// a list scan
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <time.h>
+
+#include "network.h"
+
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static dv_table_t *table_create(void) {
+  dv_table_t *table = (dv_table_t *)calloc(1, sizeof(*table));
+  table->table_mutex = &table_mutex;
+  slab_pool_init(&table->dest_pool, sizeof(dv_dest_entry_t), 256);
+  return table;
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static ip_subnet_t nth_subnet(size_t i, uint8_t prefix_len) {
+  uint32_t addr;
+  switch (prefix_len) {
+  case 8:
+    addr = (uint32_t)(i + 1) << 24;
+    break;
+  case 16:
+    addr = 10u << 24 | (uint32_t)i << 16;
+    break;
+  default:
+    addr = 10u << 24 | (uint32_t)i << 8;
+    break;
+  }
+  return (ip_subnet_t){{(uint8_t)(addr >> 24), (uint8_t)(addr >> 16),
+                        (uint8_t)(addr >> 8), (uint8_t)addr},
+                       prefix_len};
+}
+
+// how far entries sit from their home slot
+static void probe_stats(const char *label, size_t count, uint8_t prefix_len) {
+  dv_table_t *table = table_create();
+  for (size_t i = 0; i < count; i++) {
+    dv_insert_dest(table, nth_subnet(i, prefix_len));
+  }
+  dv_dest_index_t *index = &table->index;
+  size_t mask = index->capacity - 1;
+  size_t total = 0, longest = 0, homes = 0;
+  bool *home_used = (bool *)calloc(index->capacity, sizeof(bool));
+  for (size_t i = 0; i < index->capacity; i++) {
+    if (index->slots[i].dest == NULL) {
+      continue;
+    }
+    size_t home = subnet_key_hash(index->slots[i].key, index->capacity);
+    size_t distance = (i - home) & mask;
+    total += distance;
+    if (distance > longest) {
+      longest = distance;
+    }
+    if (!home_used[home]) {
+      home_used[home] = true;
+      homes++;
+    }
+  }
+  printf("%-14s %6zu prefixes, capacity %6zu: %6zu home slots, "
+         "probe avg %.2f max %zu\n",
+         label, count, index->capacity, homes, (double)total / count,
+         longest);
+  free(home_used);
+}
+
+static dv_dest_entry_t *list_find(dv_table_t *table, ip_subnet_t subnet) {
+  for (dv_dest_entry_t *dest = table->head; dest != NULL; dest = dest->next) {
+    if (subnet_cmpr(dest->dest, subnet)) {
+      return dest;
+    }
+  }
+  return NULL;
+}
+
+// the destinations of one DV of dv_len routes looked up the way the
+// processor does, in a table of size routes
+static void find_cost(size_t size, size_t dv_len) {
+  dv_table_t *table = table_create();
+  for (size_t i = 0; i < size; i++) {
+    dv_insert_dest(table, nth_subnet(i, 24));
+  }
+
+  ip_subnet_t *dv = (ip_subnet_t *)malloc(dv_len * sizeof(*dv));
+  for (size_t i = 0; i < dv_len; i++) {
+    dv[i] = nth_subnet((i * 7919) % size, 24);
+  }
+
+  int rounds = 20;
+  volatile size_t found = 0;
+  double start = now_ns();
+  for (int r = 0; r < rounds; r++) {
+    for (size_t i = 0; i < dv_len; i++) {
+      found += dv_insert_dest(table, dv[i]) != NULL;
+    }
+  }
+  double indexed = (now_ns() - start) / rounds / dv_len;
+
+  // the list scan is quadratic, sample a slice of the DV
+  size_t sample = dv_len < 200 ? dv_len : 200;
+  start = now_ns();
+  for (size_t i = 0; i < sample; i++) {
+    found += list_find(table, dv[i]) != NULL;
+  }
+  double scanned = (now_ns() - start) / sample;
+
+  printf("table %7zu routes: lookup %7.1f ns/route (hash index), "
+         "lookup %10.1f ns/route (list scan)\n",
+         size, indexed, scanned);
+  free(dv);
+}
+
+int main(void) {
+  probe_stats("/8 prefixes", 200, 8);
+  probe_stats("10.x/16", 256, 16);
+  probe_stats("10.x.y/24", 512, 24);
+  probe_stats("10.x.y/24", 65536, 24);
+
+  for (size_t size = 1000; size <= 100000; size *= 10) {
+    find_cost(size, 1000);
+  }
+  return 0;
+}
@@ -0,0 +1,187 @@
+// DV parsing throughput in routes per second: the single pass text
+// parser and the binary parser, against the strchr/sscanf parser
+// they replaced
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+
+#include "network.h"
+
+#define PARSE_ROUNDS 20000
+#define ROUTES_MAX 150
+
+typedef struct legacy_entry_t {
+  legacy_entry_t *next;
+  ip_subnet_t dest;
+  uint32_t cost;
+} legacy_entry_t;
+
+typedef struct legacy_msg_t {
+  ip_addr_t sender;
+  legacy_entry_t *head;
+} legacy_msg_t;
+
+static void legacy_free(legacy_msg_t *msg) {
+  if (!msg) {
+    return;
+  }
+  legacy_entry_t *entry = msg->head;
+  while (entry != NULL) {
+    legacy_entry_t *next = entry->next;
+    free(entry);
+    entry = next;
+  }
+  free(msg);
+}
+
+// the original text parser, kept here only to compare against,
+// with its malloc per message and per route
+static legacy_msg_t *legacy_parse(char *dv_str) {
+  legacy_msg_t *msg = (legacy_msg_t *)malloc(sizeof(*msg));
+  if (!msg) {
+    return NULL;
+  }
+  msg->head = NULL;
+
+  char *cursor = strchr(dv_str, ':');
+  if (!cursor) {
+    legacy_free(msg);
+    return NULL;
+  }
+  char sender_buff[16];
+  size_t sender_len = cursor - dv_str;
+  if (sender_len >= sizeof(sender_buff)) {
+    legacy_free(msg);
+    return NULL;
+  }
+  memcpy(sender_buff, dv_str, sender_len);
+  sender_buff[sender_len] = '\0';
+  msg->sender = get_addr_from_str(sender_buff);
+
+  cursor++;
+  if (strncmp(cursor, "DV:", 3) != 0) {
+    legacy_free(msg);
+    return NULL;
+  }
+  cursor += 3;
+
+  while (*cursor == '(') {
+    cursor++;
+    char *close_paren = strchr(cursor, ')');
+    char *comma = strchr(cursor, ',');
+
+    char subnet_buff[24];
+    size_t subnet_len = comma - cursor;
+    if (subnet_len >= sizeof(subnet_buff)) {
+      break;
+    }
+    memcpy(subnet_buff, cursor, subnet_len);
+    subnet_buff[subnet_len] = '\0';
+
+    ip_subnet_t subnet = get_subnet_from_str(subnet_buff);
+    cursor = comma + 1;
+    uint32_t cost = (uint32_t)strtoul(cursor, NULL, 10);
+
+    legacy_entry_t *entry = (legacy_entry_t *)malloc(sizeof(*entry));
+    if (!entry) {
+      break;
+    }
+    entry->dest = subnet;
+    entry->cost = cost;
+    entry->next = msg->head;
+    msg->head = entry;
+
+    cursor = close_paren + 2;
+  }
+  return msg;
+}
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// one datagram in the given format from a snapshot of routes
+static size_t build_dv(const dv_snapshot_t *snap, bool binary, char *buf) {
+  dv_encoding_t enc;
+  dv_encoding_init(&enc);
+  if (!(binary ? dv_encode_binary(snap, &enc) : dv_encode(snap, &enc)) ||
+      enc.chunk_count != 1) {
+    fprintf(stderr, "DV does not fit one datagram\n");
+    exit(1);
+  }
+  ip_addr_t sender = {10, 9, 0, 2};
+  size_t header = binary ? dv_encode_binary_header(sender, &enc, 0, buf)
+                         : dv_encode_header(sender, &enc, 0, buf);
+  size_t len = header + enc.len;
+  memcpy(buf + header, enc.body, enc.len);
+  buf[len] = '\0';
+  dv_encoding_free(&enc);
+  return len;
+}
+
+static void report(const char *label, double seconds, size_t routes) {
+  printf("%-28s %8.2f M routes/s\n", label,
+         (double)routes * PARSE_ROUNDS / seconds / 1e6);
+}
+
+int main(void) {
+  // as many /24 text entries as fit one datagram
+  size_t count = 60;
+  dv_snapshot_t *snap = (dv_snapshot_t *)malloc(sizeof(*snap) +
+                                                count * sizeof(dv_advert_t));
+  snap->refs = 1;
+  snap->generation = 1;
+  snap->count = count;
+  snap->routes = (dv_advert_t *)(snap + 1);
+  srand(1);
+  for (size_t i = 0; i < count; i++) {
+    snap->routes[i].dest = (ip_subnet_t){
+        {10, (uint8_t)(rand() % 256), (uint8_t)(rand() % 256), 0}, 24};
+    snap->routes[i].cost = 1 + rand() % 15;
+  }
+
+  char text[DV_CHUNK_SIZE + 1];
+  char binary[DV_CHUNK_SIZE + 1];
+  size_t text_len = build_dv(snap, false, text);
+  size_t binary_len = build_dv(snap, true, binary);
+
+  dv_parsed_msg_t msg;
+  msg.routes = (dv_advert_t *)malloc(ROUTES_MAX * sizeof(*msg.routes));
+  size_t parsed = 0;
+
+  double start = now_sec();
+  for (int r = 0; r < PARSE_ROUNDS; r++) {
+    parse_distance_vector(text, text_len, &msg, ROUTES_MAX);
+    parsed += msg.count;
+  }
+  report("text, single pass", now_sec() - start, count);
+
+  start = now_sec();
+  for (int r = 0; r < PARSE_ROUNDS; r++) {
+    parse_distance_vector_binary(binary, binary_len, &msg, ROUTES_MAX);
+    parsed += msg.count;
+  }
+  report("binary", now_sec() - start, count);
+
+  char copy[DV_CHUNK_SIZE + 1];
+  start = now_sec();
+  for (int r = 0; r < PARSE_ROUNDS; r++) {
+    // the old parser wrote into the receive buffer
+    memcpy(copy, text, text_len + 1);
+    legacy_msg_t *legacy = legacy_parse(copy);
+    for (legacy_entry_t *e = legacy ? legacy->head : NULL; e; e = e->next) {
+      parsed++;
+    }
+    legacy_free(legacy);
+  }
+  report("text, strchr/sscanf", now_sec() - start, count);
+
+  printf("(%zu routes parsed from %zu text / %zu binary byte datagrams)\n",
+         parsed, text_len, binary_len);
+  free(msg.routes);
+  free(snap);
+  return 0;
+}
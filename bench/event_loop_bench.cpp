@@ -0,0 +1,216 @@
+// receive cost of the two event loops: cpu time and wakeups per
+// datagram for the epoll receiver thread and the io_uring loop,
+// each fed the same loopback DV traffic in a child process
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "log.h"
+#include "lpm.h"
+#include "processor.h"
+#include "receiver.h"
+#include "router.h"
+#include "sender.h"
+#include "uring.h"
+
+// datagrams per second in the paced phase, and in the flood
+#define PACED_RATE 20000
+#define FLOOD_COUNT 200000
+
+typedef struct bench_loop_t {
+  receiver_data_t receiver;
+  sender_data_t sender;
+  router_housekeeping_t housekeeping;
+  bool uring_failed;
+} bench_loop_t;
+
+static pthread_mutex_t cout_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t hello_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t install_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t install_cond = PTHREAD_COND_INITIALIZER;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// stands in for the processor, slots go straight back
+static void *consumer_main(void *arg) {
+  msg_queue_t *queue = (msg_queue_t *)arg;
+  uint16_t next = 0;
+  while (true) {
+    msg_queue_t *from;
+    msg_queue_entry_t *head = get_msg_queue_head(queue, 1, &next, &from);
+    if (head != NULL) {
+      msg_slot_release(from->slots, head);
+    }
+  }
+  return NULL;
+}
+
+static void *uring_thread_main(void *arg) {
+  bench_loop_t *loop = (bench_loop_t *)arg;
+  // only returns if io_uring could not start
+  uring_main(&loop->receiver, &loop->sender, &loop->housekeeping);
+  __atomic_store_n(&loop->uring_failed, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+// the parts of the router state the receive path and the
+// io_uring timers touch, with no interfaces to send on
+static void bench_loop_init(bench_loop_t *loop, router_socket_t *socket) {
+  memset(loop, 0, sizeof(*loop));
+
+  msg_wake_t *wake = (msg_wake_t *)malloc(sizeof(*wake));
+  msg_slots_t *slots = (msg_slots_t *)malloc(sizeof(*slots));
+  msg_queue_t *queue = (msg_queue_t *)malloc(sizeof(*queue));
+  if (!wake || !slots || !queue || !msg_wake_init(wake) ||
+      !msg_slots_init(slots, MSG_SLOT_COUNT, REC_BUFF_SIZE) ||
+      !msg_queue_init(queue, MSG_QUEUE_LEN, slots, wake)) {
+    exit(1);
+  }
+
+  hello_table_t *hello_table = (hello_table_t *)calloc(1, sizeof(*hello_table));
+  hello_table->table_mutex = &hello_mutex;
+
+  dv_table_t *table = (dv_table_t *)calloc(1, sizeof(*table));
+  table->max_paths = 1;
+  slab_pool_init(&table->dest_pool, sizeof(dv_dest_entry_t), 256);
+  table->fib = lpm_create();
+  table->table_mutex = &table_mutex;
+
+  slab_pool_t *change_pool = (slab_pool_t *)malloc(sizeof(*change_pool));
+  slab_pool_init(change_pool, sizeof(fib_change_t), 16);
+  install_queue_t *install_queue =
+      (install_queue_t *)malloc(sizeof(*install_queue));
+  install_queue_init(install_queue, &install_mutex, &install_cond,
+                     change_pool);
+
+  router_data_t *data = (router_data_t *)calloc(1, sizeof(*data));
+  data->cout_mutex = &cout_mutex;
+
+  socket_list_t sockets = {socket, 1, false, NULL, 0};
+  loop->receiver = {{NULL, 0}, sockets, queue, hello_table, -1};
+  loop->sender = {{NULL, 0}, sockets, hello_table, table, &cout_mutex};
+  loop->housekeeping = {data, hello_table, table, install_queue, false, 0};
+}
+
+typedef struct bench_sample_t {
+  double at;
+  double cpu_sec;
+  size_t received;
+  size_t wakeups;
+} bench_sample_t;
+
+static bench_sample_t sample(msg_queue_t *queue) {
+  return (bench_sample_t){now_sec(), msg_queue_cpu_sec(queue),
+                          __atomic_load_n(&queue->received, __ATOMIC_RELAXED),
+                          __atomic_load_n(&queue->wakeups, __ATOMIC_RELAXED)};
+}
+
+static void report(int out, const char *label, bench_sample_t start,
+                   bench_sample_t end) {
+  size_t received = end.received - start.received;
+  size_t wakeups = end.wakeups - start.wakeups;
+  double n = received ? (double)received : 1;
+  dprintf(out,
+          "%-22s %7zu datagrams, %8.0f wakeups/s, %5.3f wakeups and "
+          "%6.2f us cpu per datagram\n",
+          label, received, wakeups / (end.at - start.at), wakeups / n,
+          (end.cpu_sec - start.cpu_sec) * 1e6 / n);
+}
+
+static void run(const char *mode, bool use_uring) {
+  int out = dup(STDOUT_FILENO);
+  // the io_uring loop prints the neighbor table on its first tick
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+  log_init(LOG_LEVEL_ERROR, &cout_mutex);
+
+  int rx = socket(AF_INET, SOCK_DGRAM, 0);
+  int rcvbuf = 4 << 20;
+  setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  if (rx < 0 || bind(rx, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      getsockname(rx, (struct sockaddr *)&addr, &addr_len) < 0) {
+    dprintf(out, "%s: could not bind a loopback socket\n", mode);
+    exit(1);
+  }
+  router_socket_t socket_entry = {"lo", rx};
+
+  bench_loop_t *loop = (bench_loop_t *)malloc(sizeof(*loop));
+  bench_loop_init(loop, &socket_entry);
+  msg_queue_t *queue = loop->receiver.msg_queue;
+
+  pthread_t consumer, reader;
+  pthread_create(&consumer, NULL, consumer_main, queue);
+  pthread_create(&reader, NULL,
+                 use_uring ? uring_thread_main : receiver_main,
+                 use_uring ? (void *)loop : (void *)&loop->receiver);
+
+  // started once the reader has recorded its thread
+  while (!__atomic_load_n(&queue->has_cpu_clock, __ATOMIC_ACQUIRE)) {
+    if (__atomic_load_n(&loop->uring_failed, __ATOMIC_ACQUIRE)) {
+      dprintf(out, "%s: unavailable\n", mode);
+      exit(0);
+    }
+    usleep(1000);
+  }
+  usleep(100000);
+
+  int tx = socket(AF_INET, SOCK_DGRAM, 0);
+  const char *dv = "10.9.0.2:DV:(10.1.0.0/24,2):(10.9.0.0/24,1):";
+  size_t dv_len = strlen(dv);
+
+  // one burst per millisecond, the loop sleeps in between
+  bench_sample_t start = sample(queue);
+  double begin = now_sec();
+  for (int ms = 0; ms < 1000; ms++) {
+    for (int i = 0; i < PACED_RATE / 1000; i++) {
+      sendto(tx, dv, dv_len, 0, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    double next = begin + (ms + 1) / 1000.0;
+    double wait = next - now_sec();
+    if (wait > 0) {
+      usleep((useconds_t)(wait * 1e6));
+    }
+  }
+  usleep(50000);
+  char label[64];
+  snprintf(label, sizeof(label), "%s, %d/s", mode, PACED_RATE);
+  report(out, label, start, sample(queue));
+
+  // back to back, the reader should batch
+  start = sample(queue);
+  for (int i = 0; i < FLOOD_COUNT; i++) {
+    sendto(tx, dv, dv_len, 0, (struct sockaddr *)&addr, sizeof(addr));
+  }
+  usleep(50000);
+  snprintf(label, sizeof(label), "%s, flood", mode);
+  report(out, label, start, sample(queue));
+  exit(0);
+}
+
+int main(void) {
+  // each model runs in its own process, neither loop ever returns
+  const char *modes[] = {"epoll threads", "io_uring"};
+  for (int i = 0; i < 2; i++) {
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+      run(modes[i], i == 1);
+    }
+    waitpid(child, NULL, 0);
+  }
+  return 0;
+}
@@ -0,0 +1,118 @@
+// longest prefix match: lookups per second from the trie, single and
+// batched, against a linear scan over every route
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+
+#include "lpm.h"
+#include "network.h"
+
+#define LOOKUP_COUNT 1000000
+#define BATCH_LEN 64
+
+typedef struct linear_route_t {
+  uint32_t prefix;
+  uint32_t mask;
+  uint8_t prefix_len;
+  ip_addr_t next_hop;
+} linear_route_t;
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t addr_u32(ip_addr_t addr) {
+  return (uint32_t)addr.f1 << 24 | (uint32_t)addr.f2 << 16 |
+         (uint32_t)addr.f3 << 8 | addr.f4;
+}
+
+static ip_addr_t u32_addr(uint32_t value) {
+  return (ip_addr_t){(uint8_t)(value >> 24), (uint8_t)(value >> 16),
+                     (uint8_t)(value >> 8), (uint8_t)value};
+}
+
+// the old way to answer "which next hop", every route checked
+static bool linear_lookup(const linear_route_t *routes, size_t count,
+                          ip_addr_t addr, ip_addr_t *next_hop) {
+  uint32_t value = addr_u32(addr);
+  int best = -1;
+  for (size_t i = 0; i < count; i++) {
+    if ((value & routes[i].mask) == routes[i].prefix &&
+        routes[i].prefix_len > best) {
+      best = routes[i].prefix_len;
+      *next_hop = routes[i].next_hop;
+    }
+  }
+  return best >= 0;
+}
+
+static void run(size_t route_count) {
+  lpm_trie_t *trie = lpm_create();
+  linear_route_t *routes =
+      (linear_route_t *)malloc(route_count * sizeof(*routes));
+
+  srand(1);
+  for (size_t i = 0; i < route_count; i++) {
+    uint8_t prefix_len = 8 + rand() % 25;
+    uint32_t mask = 0xFFFFFFFFu << (32 - prefix_len);
+    uint32_t prefix = ((uint32_t)rand() << 1 ^ rand()) & mask;
+    ip_addr_t next_hop = {10, 0, (uint8_t)(i >> 8), (uint8_t)i};
+    routes[i] = (linear_route_t){prefix, mask, prefix_len, next_hop};
+    lpm_insert(trie, (ip_subnet_t){u32_addr(prefix), prefix_len}, next_hop);
+  }
+
+  ip_addr_t *addrs = (ip_addr_t *)malloc(LOOKUP_COUNT * sizeof(*addrs));
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    // half the lookups fall inside a known route
+    uint32_t value = (uint32_t)rand() << 1 ^ rand();
+    if (i % 2 == 0) {
+      const linear_route_t *route = &routes[rand() % route_count];
+      value = route->prefix | (value & ~route->mask);
+    }
+    addrs[i] = u32_addr(value);
+  }
+
+  ip_addr_t next_hop;
+  size_t found = 0;
+  double start = now_sec();
+  for (size_t i = 0; i < LOOKUP_COUNT; i++) {
+    found += lpm_lookup(trie, addrs[i], &next_hop);
+  }
+  double single = LOOKUP_COUNT / (now_sec() - start);
+
+  ip_addr_t next_hops[BATCH_LEN];
+  bool hits[BATCH_LEN];
+  start = now_sec();
+  for (size_t i = 0; i + BATCH_LEN <= LOOKUP_COUNT; i += BATCH_LEN) {
+    found += lpm_lookup_batch(trie, &addrs[i], BATCH_LEN, next_hops, hits);
+  }
+  double batched = LOOKUP_COUNT / (now_sec() - start);
+
+  // the scan is linear in the table, sample fewer lookups
+  size_t sample = LOOKUP_COUNT / route_count * 10;
+  if (sample > LOOKUP_COUNT) {
+    sample = LOOKUP_COUNT;
+  }
+  start = now_sec();
+  for (size_t i = 0; i < sample; i++) {
+    found += linear_lookup(routes, route_count, addrs[i], &next_hop);
+  }
+  double scanned = sample / (now_sec() - start);
+
+  printf("%7zu routes: trie %6.2f M/s, batched %6.2f M/s, "
+         "linear scan %9.4f M/s (%zu hits)\n",
+         route_count, single / 1e6, batched / 1e6, scanned / 1e6, found);
+
+  free(addrs);
+  free(routes);
+  lpm_destroy(trie);
+}
+
+int main(void) {
+  for (size_t route_count = 100; route_count <= 100000; route_count *= 10) {
+    run(route_count);
+  }
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+
+#include "config.h"
+#include "network.h"
+
+router_config_t default_router_config(void) {
+  router_config_t config;
+  config.restart_grace = DEFAULT_RESTART_GRACE;
+  config.max_paths = DEFAULT_MAX_PATHS;
+  config.batch_size = DEFAULT_BATCH_SIZE;
+  config.batch_latency_ms = DEFAULT_BATCH_LATENCY_MS;
+  config.log_level = LOG_LEVEL_INFO;
+  config.receivers = DEFAULT_RECEIVERS;
+  config.shared_socket = false;
+  config.io_uring = false;
+  return config;
+}
+
+static bool parse_int(const char *str, int min, int max, int *out) {
+  char *end;
+  long value = strtol(str, &end, 10);
+  if (*str == '\0' || *end != '\0' || value < min || value > max) {
+    return false;
+  }
+  *out = (int)value;
+  return true;
+}
+
+bool parse_router_config(int argc, char **argv, router_config_t *config) {
+  static struct option long_options[] = {
+      {"restart-grace", required_argument, NULL, 'g'},
+      {"max-paths", required_argument, NULL, 'm'},
+      {"batch-size", required_argument, NULL, 'b'},
+      {"batch-latency", required_argument, NULL, 'l'},
+      {"receivers", required_argument, NULL, 'r'},
+      {"quiet", no_argument, NULL, 'q'},
+      {"verbose", no_argument, NULL, 'v'},
+      {"shared-socket", no_argument, NULL, 's'},
+      {"io-uring", no_argument, NULL, 'u'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "g:m:b:l:r:qvsuh", long_options,
+                            NULL)) != -1) {
+    switch (opt) {
+    case 'g':
+      if (!parse_int(optarg, 0, 1000000, &config->restart_grace)) {
+        std::cout << "ERROR: invalid restart grace: " << optarg << std::endl;
+        return false;
+      }
+      break;
+    case 'm':
+      if (!parse_int(optarg, 1, DV_MAX_PATHS, &config->max_paths)) {
+        std::cout << "ERROR: max paths must be 1-" << DV_MAX_PATHS << ": "
+                  << optarg << std::endl;
+        return false;
+      }
+      break;
+    case 'b':
+      if (!parse_int(optarg, 1, 1000000, &config->batch_size)) {
+        std::cout << "ERROR: invalid batch size: " << optarg << std::endl;
+        return false;
+      }
+      break;
+    case 'l':
+      if (!parse_int(optarg, 0, 60000, &config->batch_latency_ms)) {
+        std::cout << "ERROR: invalid batch latency: " << optarg << std::endl;
+        return false;
+      }
+      break;
+    case 'r':
+      if (!parse_int(optarg, 1, MAX_RECEIVERS, &config->receivers)) {
+        std::cout << "ERROR: receivers must be 1-" << MAX_RECEIVERS << ": "
+                  << optarg << std::endl;
+        return false;
+      }
+      break;
+    case 'q':
+      config->log_level = LOG_LEVEL_WARN;
+      break;
+    case 'v':
+      config->log_level = LOG_LEVEL_DEBUG;
+      break;
+    case 's':
+      config->shared_socket = true;
+      break;
+    case 'u':
+      config->io_uring = true;
+      break;
+    default:
+      return false;
+    }
+  }
+  return optind == argc;
+}
+
+void print_usage(const char *prog) {
+  std::cout << "Usage: " << prog << " [options]\n"
+            << "  -g, --restart-grace SEC  stable seconds before stale "
+               "kernel routes are removed (default "
+            << DEFAULT_RESTART_GRACE << ")\n"
+            << "  -m, --max-paths N        equal cost next hops per route "
+               "(default "
+            << DEFAULT_MAX_PATHS << ")\n"
+            << "  -b, --batch-size N       messages applied per kernel sync "
+               "(default "
+            << DEFAULT_BATCH_SIZE << ")\n"
+            << "  -l, --batch-latency MS   longest a batch runs before its "
+               "sync (default "
+            << DEFAULT_BATCH_LATENCY_MS << ")\n"
+            << "  -r, --receivers N        receiver threads, each pinned to a "
+               "core with its\n"
+            << "                           own interfaces (default "
+            << DEFAULT_RECEIVERS << ")\n"
+            << "  -q, --quiet              log warnings and errors only\n"
+            << "  -v, --verbose            debug logs and a table dump per "
+               "batch, if\n"
+            << "                           built with LOG_COMPILE_LEVEL=0\n"
+            << "  -s, --shared-socket      one IP_PKTINFO socket for all "
+               "interfaces\n"
+            << "  -u, --io-uring           receive, send and timers in one "
+               "io_uring loop\n"
+            << "  -h, --help               show this message" << std::endl;
+}
@@ -0,0 +1,43 @@
+#ifndef CONFIG_H_INCLUDED
+#define CONFIG_H_INCLUDED
+
+#include "log.h"
+
+// seconds the table must stay unchanged after a restart
+// before routes adopted from the kernel but never
+// relearned are deleted
+#define DEFAULT_RESTART_GRACE 30
+
+// equal cost next hops installed per destination
+#define DEFAULT_MAX_PATHS 4
+
+// queued messages the processor applies before a
+// single kernel sync, and the longest a batch may run
+#define DEFAULT_BATCH_SIZE 64
+#define DEFAULT_BATCH_LATENCY_MS 50
+
+// receiver worker threads, each with its own share of the
+// interfaces and its own queue to the processor
+#define DEFAULT_RECEIVERS 1
+#define MAX_RECEIVERS 64
+
+typedef struct router_config_t {
+  int restart_grace;
+  int max_paths;
+  int batch_size;
+  int batch_latency_ms;
+  int log_level;
+  int receivers;
+  // one IP_PKTINFO socket instead of one per interface
+  bool shared_socket;
+  // receive, send and timers in one io_uring loop
+  bool io_uring;
+} router_config_t;
+
+router_config_t default_router_config(void);
+
+bool parse_router_config(int argc, char **argv, router_config_t *config);
+
+void print_usage(const char *prog);
+
+#endif
@@ -0,0 +1,143 @@
+// fuzz target for the DV parsers, each input is copied into a buffer of
+// exactly its length so the sanitizers catch any read past the datagram
+//
+// built by `make fuzz` with a random mutation driver under ASan/UBSan,
+// or with clang -fsanitize=fuzzer,address -DDV_FUZZ_LIBFUZZER to run the
+// same target under libFuzzer
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "network.h"
+
+// as many routes as the processor accepts from one datagram
+#define FUZZ_ROUTES_MAX (4096 / 3)
+
+static dv_advert_t routes[FUZZ_ROUTES_MAX];
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  char *msg = (char *)malloc(size ? size : 1);
+  memcpy(msg, data, size);
+
+  dv_parsed_msg_t parsed;
+  parsed.routes = routes;
+  dv_chunk_t chunk;
+  bool has_chunk = dv_read_chunk(msg, size, &chunk);
+  bool ok = dv_is_binary(msg, size)
+                ? parse_distance_vector_binary(msg, size, &parsed,
+                                               FUZZ_ROUTES_MAX)
+                : parse_distance_vector(msg, size, &parsed, FUZZ_ROUTES_MAX);
+  if (ok) {
+    // whatever is accepted has to be something the encoders could send
+    if (!has_chunk || parsed.chunk.index >= parsed.chunk.count) {
+      abort();
+    }
+    for (size_t i = 0; i < parsed.count; i++) {
+      if (parsed.routes[i].dest.prefix_len > 32) {
+        abort();
+      }
+    }
+  }
+
+  free(msg);
+  return 0;
+}
+
+#ifndef DV_FUZZ_LIBFUZZER
+
+#define FUZZ_INPUT_MAX 4096
+
+static const char *text_seeds[] = {
+    "10.9.0.2:DV:(10.1.0.0/24,2):(10.9.0.0/24,1):(0.0.0.0/0,16):",
+    "10.9.0.2:DV:",
+    "10.9.0.2:DVC:7:1:3:(10.1.0.0/24,2):(192.168.255.255/32,255)",
+    "255.255.255.255:DVC:4294967295:65534:65535:(1.2.3.4/8,1):",
+};
+
+static const uint8_t binary_seeds[][32] = {
+    {0xD7, 1, 0, 0, 10, 9, 0, 2, 10, 1, 0, 0, 24, 2, 10, 9, 0, 0, 24, 1},
+    {0xD7, 1, DV_BIN_DELTA, 0, 10, 9, 0, 2, 0x80, 0x80, 0x80, 0x50, 24, 2,
+     0x80, 0x02, 24, 1},
+    {0xD7, 1, DV_BIN_DELTA | DV_BIN_CHUNKED, 0, 10, 9, 0, 2, 0, 0, 0, 7, 0,
+     1, 0, 3, 0x80, 0x80, 0x80, 0x50, 24, 2},
+};
+static const size_t binary_seed_lens[] = {20, 18, 22};
+
+static size_t pick_seed(uint8_t *buf) {
+  size_t text_count = sizeof(text_seeds) / sizeof(*text_seeds);
+  size_t binary_count = sizeof(binary_seed_lens) / sizeof(*binary_seed_lens);
+  size_t seed = rand() % (text_count + binary_count);
+  if (seed < text_count) {
+    size_t len = strlen(text_seeds[seed]);
+    memcpy(buf, text_seeds[seed], len);
+    return len;
+  }
+  seed -= text_count;
+  memcpy(buf, binary_seeds[seed], binary_seed_lens[seed]);
+  return binary_seed_lens[seed];
+}
+
+// a few random edits: flip, overwrite with a delimiter,
+// insert, delete or truncate
+static size_t mutate(uint8_t *buf, size_t len) {
+  static const char tokens[] = "():,./0123456789DVC";
+  int edits = 1 + rand() % 4;
+  for (int e = 0; e < edits; e++) {
+    size_t at = len ? rand() % len : 0;
+    switch (rand() % 5) {
+    case 0:
+      if (len) {
+        buf[at] ^= 1 << (rand() % 8);
+      }
+      break;
+    case 1:
+      if (len) {
+        buf[at] = tokens[rand() % (sizeof(tokens) - 1)];
+      }
+      break;
+    case 2:
+      if (len < FUZZ_INPUT_MAX) {
+        memmove(buf + at + 1, buf + at, len - at);
+        buf[at] = rand() % 2 ? rand() : tokens[rand() % (sizeof(tokens) - 1)];
+        len++;
+      }
+      break;
+    case 3:
+      if (len) {
+        memmove(buf + at, buf + at + 1, len - at - 1);
+        len--;
+      }
+      break;
+    default:
+      len = at;
+      break;
+    }
+  }
+  return len;
+}
+
+int main(int argc, char **argv) {
+  long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+  unsigned seed = argc > 2 ? (unsigned)atol(argv[2]) : 1;
+  srand(seed);
+
+  uint8_t buf[FUZZ_INPUT_MAX];
+  for (long i = 0; i < iterations; i++) {
+    size_t len = mutate(buf, pick_seed(buf));
+    LLVMFuzzerTestOneInput(buf, len);
+
+    // random bytes behind a valid looking start
+    len = rand() % 64;
+    for (size_t j = 0; j < len; j++) {
+      buf[j] = rand();
+    }
+    if (len && rand() % 2) {
+      buf[0] = DV_BIN_MAGIC;
+    }
+    LLVMFuzzerTestOneInput(buf, len);
+  }
+  printf("dv_parse_fuzz: %ld iterations, seed %u\n", iterations, seed);
+  return 0;
+}
+
+#endif
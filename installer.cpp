@@ -0,0 +1,232 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "installer.h"
+#include "log.h"
+
+#define INSTALL_INDEX_MIN_CAPACITY 64
+
+static double elapsed_ms(struct timespec from, struct timespec to) {
+  return (double)(to.tv_sec - from.tv_sec) * 1000.0 +
+         (double)(to.tv_nsec - from.tv_nsec) / 1000000.0;
+}
+
+static void index_put(install_queue_t *queue, uint64_t key,
+                      fib_change_t *change) {
+  size_t i = subnet_key_hash(key, queue->capacity);
+  while (queue->slots[i].change != NULL) {
+    i = (i + 1) & (queue->capacity - 1);
+  }
+  queue->slots[i].key = key;
+  queue->slots[i].change = change;
+}
+
+static void index_grow(install_queue_t *queue) {
+  fib_change_slot_t *old_slots = queue->slots;
+  size_t old_capacity = queue->capacity;
+
+  queue->capacity =
+      old_capacity ? old_capacity * 2 : (size_t)INSTALL_INDEX_MIN_CAPACITY;
+  queue->slots =
+      (fib_change_slot_t *)calloc(queue->capacity, sizeof(*queue->slots));
+
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old_slots[i].change != NULL) {
+      index_put(queue, old_slots[i].key, old_slots[i].change);
+    }
+  }
+  free(old_slots);
+}
+
+static fib_change_t *index_find(install_queue_t *queue, uint64_t key) {
+  if (queue->depth == 0) {
+    return NULL;
+  }
+  size_t i = subnet_key_hash(key, queue->capacity);
+  while (queue->slots[i].change != NULL) {
+    if (queue->slots[i].key == key) {
+      return queue->slots[i].change;
+    }
+    i = (i + 1) & (queue->capacity - 1);
+  }
+  return NULL;
+}
+
+// backward shift deletion keeps probe chains intact
+static void index_remove(install_queue_t *queue, uint64_t key) {
+  size_t mask = queue->capacity - 1;
+  size_t i = subnet_key_hash(key, queue->capacity);
+  while (queue->slots[i].change != NULL && queue->slots[i].key != key) {
+    i = (i + 1) & mask;
+  }
+  if (queue->slots[i].change == NULL) {
+    return;
+  }
+
+  size_t hole = i;
+  size_t j = i;
+  while (true) {
+    j = (j + 1) & mask;
+    if (queue->slots[j].change == NULL) {
+      break;
+    }
+    size_t home = subnet_key_hash(queue->slots[j].key, queue->capacity);
+    // move j into the hole unless its home lies in (hole, j]
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      queue->slots[hole] = queue->slots[j];
+      hole = j;
+    }
+  }
+  queue->slots[hole].change = NULL;
+}
+
+void install_queue_init(install_queue_t *queue, pthread_mutex_t *queue_mutex,
+                        pthread_cond_t *queue_cond, slab_pool_t *change_pool) {
+  queue->head = NULL;
+  queue->tail = NULL;
+  queue->slots = NULL;
+  queue->capacity = 0;
+  queue->depth = 0;
+  queue->queue_mutex = queue_mutex;
+  queue->queue_cond = queue_cond;
+  queue->change_pool = change_pool;
+  queue->queued = 0;
+  queue->coalesced = 0;
+  queue->installed = 0;
+  queue->failed = 0;
+  queue->last_lag_ms = 0;
+  queue->max_lag_ms = 0;
+}
+
+// caller holds queue_mutex and signals queue_cond
+// once it has pushed a batch of changes
+bool install_queue_push(install_queue_t *queue, ip_subnet_t dest,
+                        const ip_addr_t *gateways, uint8_t n_gateways) {
+  uint64_t key = subnet_key(dest);
+  queue->queued++;
+
+  if (n_gateways > DV_MAX_PATHS) {
+    n_gateways = DV_MAX_PATHS;
+  }
+
+  fib_change_t *change = index_find(queue, key);
+  if (change != NULL) {
+    // only the latest desired state is written
+    change->n_gateways = n_gateways;
+    // deletes pass no gateways at all
+    if (n_gateways) {
+      memcpy(change->gateways, gateways, n_gateways * sizeof(*gateways));
+    }
+    queue->coalesced++;
+    return true;
+  }
+
+  change = (fib_change_t *)slab_alloc(queue->change_pool);
+  if (!change) {
+    queue->failed++;
+    LOG_ERROR("Out of memory queueing route %u.%u.%u.%u/%u, %zu changes lost",
+              dest.addr.f1, dest.addr.f2, dest.addr.f3, dest.addr.f4,
+              dest.prefix_len, queue->failed);
+    return false;
+  }
+  change->next = NULL;
+  change->dest = dest;
+  change->n_gateways = n_gateways;
+  if (n_gateways) {
+    memcpy(change->gateways, gateways, n_gateways * sizeof(*gateways));
+  }
+  clock_gettime(CLOCK_MONOTONIC, &change->queued_at);
+
+  if ((queue->depth + 1) * 2 > queue->capacity) {
+    index_grow(queue);
+  }
+  index_put(queue, key, change);
+
+  if (queue->head == NULL) {
+    queue->head = change;
+  } else {
+    queue->tail->next = change;
+  }
+  queue->tail = change;
+  queue->depth++;
+  return true;
+}
+
+install_stats_t get_install_stats(install_queue_t *queue) {
+  install_stats_t stats;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock(queue->queue_mutex);
+  stats.depth = queue->depth;
+  stats.queued = queue->queued;
+  stats.coalesced = queue->coalesced;
+  stats.installed = queue->installed;
+  stats.failed = queue->failed;
+  stats.change_slabs = queue->change_pool->heap_allocs;
+  stats.lag_ms =
+      queue->head != NULL ? elapsed_ms(queue->head->queued_at, now) : 0;
+  stats.last_lag_ms = queue->last_lag_ms;
+  stats.max_lag_ms = queue->max_lag_ms;
+  pthread_mutex_unlock(queue->queue_mutex);
+
+  return stats;
+}
+
+void *installer_main(void *arg) {
+  installer_data_t *data = (installer_data_t *)arg;
+  install_queue_t *queue = data->queue;
+
+  while (true) {
+    pthread_mutex_lock(queue->queue_mutex);
+    while (queue->head == NULL) {
+      pthread_cond_wait(queue->queue_cond, queue->queue_mutex);
+    }
+
+    // take every pending change, later pushes start a new batch
+    fib_change_t *batch = queue->head;
+    size_t depth = queue->depth;
+    for (fib_change_t *change = batch; change != NULL; change = change->next) {
+      index_remove(queue, subnet_key(change->dest));
+    }
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->depth = 0;
+    pthread_mutex_unlock(queue->queue_mutex);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double lag_ms = elapsed_ms(batch->queued_at, start);
+
+    fib_change_t *change = batch;
+    while (change != NULL) {
+      fib_change_t *next = change->next;
+      if (change->n_gateways > 0) {
+        nl_fib_replace(data->fib, change->dest, change->gateways,
+                       change->n_gateways);
+      } else {
+        nl_fib_delete(data->fib, change->dest);
+      }
+      slab_free_remote(queue->change_pool, change);
+      change = next;
+    }
+
+    nl_fib_flush(data->fib);
+    // errors for earlier batches are reported as they arrive
+    nl_fib_poll_errors(data->fib);
+
+    pthread_mutex_lock(queue->queue_mutex);
+    queue->installed += depth;
+    queue->last_lag_ms = lag_ms;
+    if (lag_ms > queue->max_lag_ms) {
+      queue->max_lag_ms = lag_ms;
+    }
+    size_t backlog = queue->depth;
+    pthread_mutex_unlock(queue->queue_mutex);
+
+    LOG_INFO("Installed %zu kernel routes (lag %.1f ms, queue depth %zu)",
+             depth, lag_ms, backlog);
+  }
+
+  return NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef INSTALLER_H_INCLUDED
+#define INSTALLER_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>
+#include <time.h>
+
+#include "netlink.h"
+#include "network.h"
+#include "pool.h"
+
+// desired kernel state for one prefix, no gateways
+// means delete, a change queued again before install
+// overwrites in place
+typedef struct fib_change_t {
+  fib_change_t *next;
+
+  ip_subnet_t dest;
+  uint8_t n_gateways;
+  ip_addr_t gateways[DV_MAX_PATHS];
+  struct timespec queued_at;
+} fib_change_t;
+
+typedef struct fib_change_slot_t {
+  uint64_t key;
+  fib_change_t *change;
+} fib_change_slot_t;
+
+// FIFO of pending changes with a prefix keyed index
+// used to coalesce, changes are allocated by the
+// processor and released by the installer thread
+typedef struct install_queue_t {
+  fib_change_t *head;
+  fib_change_t *tail;
+
+  fib_change_slot_t *slots;
+  size_t capacity;
+  size_t depth;
+
+  pthread_mutex_t *queue_mutex;
+  pthread_cond_t *queue_cond;
+  slab_pool_t *change_pool;
+
+  size_t queued;
+  size_t coalesced;
+  size_t installed;
+  // changes lost because the pool could not grow
+  size_t failed;
+  double last_lag_ms;
+  double max_lag_ms;
+} install_queue_t;
+
+typedef struct install_stats_t {
+  size_t depth;
+  size_t queued;
+  size_t coalesced;
+  size_t installed;
+  size_t failed;
+  // slab mallocs of the change pool
+  size_t change_slabs;
+  double lag_ms;
+  double last_lag_ms;
+  double max_lag_ms;
+} install_stats_t;
+
+typedef struct installer_data_t {
+  install_queue_t *queue;
+  nl_fib_t *fib;
+} installer_data_t;
+
+void install_queue_init(install_queue_t *queue, pthread_mutex_t *queue_mutex,
+                        pthread_cond_t *queue_cond, slab_pool_t *change_pool);
+
+// false if out of memory, the change is then not queued
+bool install_queue_push(install_queue_t *queue, ip_subnet_t dest,
+                        const ip_addr_t *gateways, uint8_t n_gateways);
+
+install_stats_t get_install_stats(install_queue_t *queue);
+
+void *installer_main(void *arg);
+
+#endif
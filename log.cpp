@@ -0,0 +1,142 @@
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <time.h>
+
+#include "log.h"
+
+// bytes the writer gathers before taking cout_mutex
+#define LOG_WRITE_BUFF_SIZE (64 * 1024)
+
+static int log_level = LOG_LEVEL_INFO;
+static pthread_mutex_t *log_cout_mutex = NULL;
+
+// rings are only ever added, at the head
+static log_ring_t *log_rings = NULL;
+static thread_local log_ring_t *log_own_ring = NULL;
+
+static const char *log_level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+static log_ring_t *log_register_ring(void) {
+  log_ring_t *ring = (log_ring_t *)calloc(1, sizeof(*ring));
+  if (!ring) {
+    return NULL;
+  }
+
+  log_ring_t *head = __atomic_load_n(&log_rings, __ATOMIC_RELAXED);
+  do {
+    ring->next = head;
+  } while (!__atomic_compare_exchange_n(&log_rings, &head, ring, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return ring;
+}
+
+bool log_enabled(int level) {
+  return level >= LOG_COMPILE_LEVEL &&
+         level >= __atomic_load_n(&log_level, __ATOMIC_RELAXED);
+}
+
+void log_write(int level, const char *fmt, ...) {
+  if (!log_enabled(level)) {
+    return;
+  }
+
+  log_ring_t *ring = log_own_ring;
+  if (ring == NULL) {
+    ring = log_own_ring = log_register_ring();
+    if (ring == NULL) {
+      return;
+    }
+  }
+
+  // never block the caller, a full ring loses the record
+  size_t tail = ring->tail;
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (tail - head >= LOG_RING_RECORDS) {
+    __atomic_store_n(&ring->drops, ring->drops + 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  log_record_t *record = &ring->records[tail % LOG_RING_RECORDS];
+  record->level = level;
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(record->text, sizeof(record->text), fmt, args);
+  va_end(args);
+
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+size_t log_drops(void) {
+  size_t drops = 0;
+  log_ring_t *ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+  while (ring != NULL) {
+    drops += __atomic_load_n(&ring->drops, __ATOMIC_RELAXED);
+    ring = ring->next;
+  }
+  return drops;
+}
+
+static void log_flush(char *buffer, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  pthread_mutex_lock(log_cout_mutex);
+  std::cout.write(buffer, len);
+  std::cout.flush();
+  pthread_mutex_unlock(log_cout_mutex);
+}
+
+static void *log_writer_main(void *arg) {
+  char *buffer = (char *)malloc(LOG_WRITE_BUFF_SIZE);
+  if (!buffer) {
+    return NULL;
+  }
+
+  while (true) {
+    size_t len = 0;
+    bool drained = false;
+
+    log_ring_t *ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+    for (; ring != NULL; ring = ring->next) {
+      size_t head = ring->head;
+      size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+      for (; head != tail; head++) {
+        log_record_t *record = &ring->records[head % LOG_RING_RECORDS];
+        // leave room for the level tag, the record and a newline
+        if (LOG_WRITE_BUFF_SIZE - len < LOG_LINE_MAX + 16) {
+          log_flush(buffer, len);
+          len = 0;
+        }
+        int n = snprintf(buffer + len, LOG_WRITE_BUFF_SIZE - len, "[%s] %s\n",
+                         log_level_names[record->level], record->text);
+        if (n > 0) {
+          len += n;
+        }
+      }
+
+      if (head != ring->head) {
+        __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+        drained = true;
+      }
+    }
+
+    log_flush(buffer, len);
+
+    if (!drained) {
+      struct timespec pause = {0, LOG_FLUSH_INTERVAL_MS * 1000000L};
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+
+void log_init(int level, pthread_mutex_t *cout_mutex) {
+  log_level = level;
+  log_cout_mutex = cout_mutex;
+
+  pthread_t writer;
+  pthread_create(&writer, NULL, log_writer_main, NULL);
+  pthread_detach(writer);
+}
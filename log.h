@@ -0,0 +1,63 @@
+#ifndef LOG_H_INCLUDED
+#define LOG_H_INCLUDED
+
+#include <pthread.h>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+// levels below this are compiled out entirely
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#endif
+
+// records per thread ring and bytes per record
+#define LOG_RING_RECORDS 256
+#define LOG_LINE_MAX 256
+
+// writer sleep when every ring was empty
+#define LOG_FLUSH_INTERVAL_MS 10
+
+// each logging thread owns one ring it fills without locks,
+// the writer thread drains every ring and does the I/O
+typedef struct log_record_t {
+  int level;
+  char text[LOG_LINE_MAX];
+} log_record_t;
+
+typedef struct log_ring_t {
+  log_ring_t *next;
+  log_record_t records[LOG_RING_RECORDS];
+
+  // advanced by the writer only
+  size_t head;
+  char head_pad[64 - sizeof(size_t)];
+  // advanced by the owning thread only
+  size_t tail;
+  size_t drops;
+} log_ring_t;
+
+void log_init(int level, pthread_mutex_t *cout_mutex);
+
+bool log_enabled(int level);
+
+void log_write(int level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+size_t log_drops(void);
+
+#define LOG_AT(level, ...)                                                     \
+  do {                                                                         \
+    if ((level) >= LOG_COMPILE_LEVEL) {                                        \
+      log_write((level), __VA_ARGS__);                                         \
+    }                                                                          \
+  } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,264 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "lpm.h"
+
+static uint32_t addr_to_u32(ip_addr_t addr) {
+  return ((uint32_t)addr.f1 << 24) | ((uint32_t)addr.f2 << 16) |
+         ((uint32_t)addr.f3 << 8) | (uint32_t)addr.f4;
+}
+
+static uint32_t prefix_mask(uint8_t len) {
+  return len == 0 ? 0 : 0xFFFFFFFFu << (32 - len);
+}
+
+// bit i counted from the most significant end
+static int prefix_bit(uint32_t key, uint8_t i) { return (key >> (31 - i)) & 1; }
+
+static uint8_t common_len(uint32_t a, uint32_t b, uint8_t max_len) {
+  uint32_t diff = a ^ b;
+  uint8_t len = diff == 0 ? 32 : (uint8_t)__builtin_clz(diff);
+  return len < max_len ? len : max_len;
+}
+
+// NULL when out of memory
+static lpm_node_t *lpm_new_node(lpm_trie_t *trie, uint32_t prefix,
+                                uint8_t prefix_len) {
+  lpm_node_t *node = (lpm_node_t *)slab_alloc(&trie->node_pool);
+  if (!node) {
+    return NULL;
+  }
+  node->child[0] = NULL;
+  node->child[1] = NULL;
+  node->prefix = prefix & prefix_mask(prefix_len);
+  node->prefix_len = prefix_len;
+  node->has_route = false;
+  node->next_hop = (ip_addr_t){0, 0, 0, 0};
+  return node;
+}
+
+
+lpm_trie_t *lpm_create(void) {
+  lpm_trie_t *trie = (lpm_trie_t *)malloc(sizeof(*trie));
+  if (!trie) {
+    return NULL;
+  }
+  trie->root = NULL;
+  trie->route_count = 0;
+  slab_pool_init(&trie->node_pool, sizeof(lpm_node_t), LPM_NODE_SLAB_COUNT);
+  return trie;
+}
+
+void lpm_destroy(lpm_trie_t *trie) {
+  if (!trie) {
+    return;
+  }
+  // every node lives in the pool's slabs
+  slab_pool_destroy(&trie->node_pool);
+  free(trie);
+}
+
+bool lpm_insert(lpm_trie_t *trie, ip_subnet_t subnet, ip_addr_t next_hop) {
+  uint8_t len = subnet.prefix_len > 32 ? 32 : subnet.prefix_len;
+  uint32_t key = addr_to_u32(subnet.addr) & prefix_mask(len);
+
+  lpm_node_t **link = &trie->root;
+  lpm_node_t *node;
+
+  while ((node = *link) != NULL) {
+    uint8_t max_len = node->prefix_len < len ? node->prefix_len : len;
+    uint8_t common = common_len(node->prefix, key, max_len);
+
+    if (common < node->prefix_len) {
+      // the new prefix diverges inside this node, split it,
+      // both nodes are allocated before the trie is touched
+      lpm_node_t *leaf = lpm_new_node(trie, key, len);
+      lpm_node_t *fork =
+          common == len ? NULL : lpm_new_node(trie, key, common);
+      if (!leaf || (common != len && !fork)) {
+        slab_free(&trie->node_pool, leaf);
+        slab_free(&trie->node_pool, fork);
+        return false;
+      }
+      leaf->has_route = true;
+      leaf->next_hop = next_hop;
+      trie->route_count++;
+
+      if (common == len) {
+        leaf->child[prefix_bit(node->prefix, len)] = node;
+        *link = leaf;
+        return true;
+      }
+
+      fork->child[prefix_bit(key, common)] = leaf;
+      fork->child[prefix_bit(node->prefix, common)] = node;
+      *link = fork;
+      return true;
+    }
+
+    if (node->prefix_len == len) {
+      if (!node->has_route) {
+        trie->route_count++;
+      }
+      node->has_route = true;
+      node->next_hop = next_hop;
+      return true;
+    }
+
+    link = &node->child[prefix_bit(key, node->prefix_len)];
+  }
+
+  node = lpm_new_node(trie, key, len);
+  if (!node) {
+    return false;
+  }
+  node->has_route = true;
+  node->next_hop = next_hop;
+  *link = node;
+  trie->route_count++;
+  return true;
+}
+
+bool lpm_remove(lpm_trie_t *trie, ip_subnet_t subnet) {
+  uint8_t len = subnet.prefix_len > 32 ? 32 : subnet.prefix_len;
+  uint32_t key = addr_to_u32(subnet.addr) & prefix_mask(len);
+
+  lpm_node_t **parent_link = NULL;
+  lpm_node_t **link = &trie->root;
+  lpm_node_t *node;
+
+  while ((node = *link) != NULL) {
+    if (node->prefix_len > len ||
+        (key & prefix_mask(node->prefix_len)) != node->prefix) {
+      return false;
+    }
+    if (node->prefix_len == len) {
+      break;
+    }
+    parent_link = link;
+    link = &node->child[prefix_bit(key, node->prefix_len)];
+  }
+
+  if (node == NULL || !node->has_route) {
+    return false;
+  }
+  node->has_route = false;
+  trie->route_count--;
+
+  // compact the path, a routeless node needs two children
+  if (node->child[0] != NULL && node->child[1] != NULL) {
+    return true;
+  }
+  *link = node->child[0] != NULL ? node->child[0] : node->child[1];
+  slab_free(&trie->node_pool, node);
+
+  if (*link == NULL && parent_link != NULL) {
+    lpm_node_t *parent = *parent_link;
+    if (!parent->has_route) {
+      *parent_link =
+          parent->child[0] != NULL ? parent->child[0] : parent->child[1];
+      slab_free(&trie->node_pool, parent);
+    }
+  }
+  return true;
+}
+
+bool lpm_lookup(const lpm_trie_t *trie, ip_addr_t addr, ip_addr_t *next_hop) {
+  uint32_t key = addr_to_u32(addr);
+  const lpm_node_t *node = trie->root;
+  const lpm_node_t *match = NULL;
+
+  while (node != NULL) {
+    if ((key & prefix_mask(node->prefix_len)) != node->prefix) {
+      break;
+    }
+    if (node->has_route) {
+      match = node;
+    }
+    if (node->prefix_len == 32) {
+      break;
+    }
+    node = node->child[prefix_bit(key, node->prefix_len)];
+  }
+
+  if (match == NULL) {
+    return false;
+  }
+  if (next_hop != NULL) {
+    *next_hop = match->next_hop;
+  }
+  return true;
+}
+
+#define LPM_BATCH_WIDTH 8
+
+// walks up to LPM_BATCH_WIDTH lookups in lockstep so the
+// node loads of independent addresses overlap
+size_t lpm_lookup_batch(const lpm_trie_t *trie, const ip_addr_t *addrs,
+                        size_t count, ip_addr_t *next_hops, bool *found) {
+  size_t n_found = 0;
+
+  // a small trie stays in cache and the lockstep walk only adds work
+  if (trie->route_count < LPM_BATCH_MIN_ROUTES) {
+    for (size_t i = 0; i < count; i++) {
+      bool hit = lpm_lookup(trie, addrs[i], &next_hops[i]);
+      if (found != NULL) {
+        found[i] = hit;
+      }
+      n_found += hit;
+    }
+    return n_found;
+  }
+
+  for (size_t base = 0; base < count; base += LPM_BATCH_WIDTH) {
+    size_t width = count - base < LPM_BATCH_WIDTH ? count - base
+                                                  : LPM_BATCH_WIDTH;
+    uint32_t keys[LPM_BATCH_WIDTH];
+    const lpm_node_t *nodes[LPM_BATCH_WIDTH];
+    const lpm_node_t *matches[LPM_BATCH_WIDTH];
+
+    for (size_t j = 0; j < width; j++) {
+      keys[j] = addr_to_u32(addrs[base + j]);
+      nodes[j] = trie->root;
+      matches[j] = NULL;
+    }
+
+    bool active = true;
+    while (active) {
+      active = false;
+      for (size_t j = 0; j < width; j++) {
+        const lpm_node_t *node = nodes[j];
+        if (node == NULL) {
+          continue;
+        }
+        if ((keys[j] & prefix_mask(node->prefix_len)) != node->prefix) {
+          nodes[j] = NULL;
+          continue;
+        }
+        if (node->has_route) {
+          matches[j] = node;
+        }
+        node = node->prefix_len == 32
+                   ? NULL
+                   : node->child[prefix_bit(keys[j], node->prefix_len)];
+        if (node != NULL) {
+          __builtin_prefetch(node);
+          active = true;
+        }
+        nodes[j] = node;
+      }
+    }
+
+    for (size_t j = 0; j < width; j++) {
+      bool hit = matches[j] != NULL;
+      if (hit) {
+        next_hops[base + j] = matches[j]->next_hop;
+      }
+      if (found != NULL) {
+        found[base + j] = hit;
+      }
+      n_found += hit;
+    }
+  }
+  return n_found;
+}
@@ -0,0 +1,52 @@
+#ifndef LPM_H_INCLUDED
+#define LPM_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#include "network.h"
+#include "pool.h"
+
+// path compressed binary (patricia) trie node,
+// prefix is kept in host byte order and masked
+// to prefix_len bits
+typedef struct lpm_node_t {
+  lpm_node_t *child[2];
+
+  uint32_t prefix;
+  uint8_t prefix_len;
+  bool has_route;
+  ip_addr_t next_hop;
+} lpm_node_t;
+
+// routes from which lpm_lookup_batch walks lookups in lockstep
+#define LPM_BATCH_MIN_ROUTES 16384
+
+// nodes carved per slab malloc
+#define LPM_NODE_SLAB_COUNT 256
+
+// longest prefix match table, a next hop
+// of 0.0.0.0 means directly connected
+typedef struct lpm_trie_t {
+  lpm_node_t *root;
+  size_t route_count;
+  slab_pool_t node_pool;
+} lpm_trie_t;
+
+lpm_trie_t *lpm_create(void);
+
+void lpm_destroy(lpm_trie_t *trie);
+
+// false if out of memory, the trie is then left unchanged
+bool lpm_insert(lpm_trie_t *trie, ip_subnet_t subnet, ip_addr_t next_hop);
+
+bool lpm_remove(lpm_trie_t *trie, ip_subnet_t subnet);
+
+bool lpm_lookup(const lpm_trie_t *trie, ip_addr_t addr, ip_addr_t *next_hop);
+
+// lockstep lookups only pay off once the trie outgrows the cache,
+// below LPM_BATCH_MIN_ROUTES routes this is a plain lpm_lookup loop
+size_t lpm_lookup_batch(const lpm_trie_t *trie, const ip_addr_t *addrs,
+                        size_t count, ip_addr_t *next_hops, bool *found);
+
+#endif
@@ -2,14 +2,23 @@
 #include <iostream>
 #include <pthread.h>
 
+#include "config.h"
+#include "log.h"
 #include "router.h"
 
-int main(void) {
+int main(int argc, char **argv) {
+  router_config_t config = default_router_config();
+  if (!parse_router_config(argc, argv, &config)) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
   std::cout << "Hello routers!" << std::endl;
 
   pthread_mutex_t cout_mutex = PTHREAD_MUTEX_INITIALIZER;
+  log_init(config.log_level, &cout_mutex);
 
-  router_data_t data = {&cout_mutex, 0};
+  router_data_t data = {&cout_mutex, 0, config};
 
   router_main(&data);
 
@@ -0,0 +1,361 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "netlink.h"
+
+#define NL_RCVBUF_SIZE (4 * 1024 * 1024)
+
+// room for nlmsghdr + rtmsg + RTA_DST + RTA_MULTIPATH
+// with DV_MAX_PATHS nexthops
+#define NL_ROUTE_MSG_MAX 256
+
+nl_fib_t *nl_fib_open(void) {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0) {
+    LOG_ERROR("could not open netlink socket: %s", strerror(errno));
+    return NULL;
+  }
+
+  // error replies for a large batch must not overflow
+  int rcvbuf = NL_RCVBUF_SIZE;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  // errors only carry the request header back
+  int cap_ack = 1;
+  setsockopt(fd, SOL_NETLINK, NETLINK_CAP_ACK, &cap_ack, sizeof(cap_ack));
+
+  struct sockaddr_nl local;
+  memset(&local, 0, sizeof(local));
+  local.nl_family = AF_NETLINK;
+  if (::bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+    LOG_ERROR("could not bind netlink socket: %s", strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  nl_fib_t *fib = (nl_fib_t *)malloc(sizeof(*fib));
+  fib->fd = fd;
+  fib->seq = 1;
+  fib->buf = (char *)malloc(NL_BATCH_SIZE);
+  fib->len = 0;
+  memset(fib->pending, 0, sizeof(fib->pending));
+  fib->sent = 0;
+  fib->errors = 0;
+  return fib;
+}
+
+void nl_fib_close(nl_fib_t *fib) {
+  if (!fib) {
+    return;
+  }
+  nl_fib_flush(fib);
+  nl_fib_poll_errors(fib);
+  close(fib->fd);
+  free(fib->buf);
+  free(fib);
+}
+
+static void nl_add_attr(struct nlmsghdr *nlh, unsigned short type,
+                        const void *data, size_t data_len) {
+  struct rtattr *rta =
+      (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+  rta->rta_type = type;
+  rta->rta_len = RTA_LENGTH(data_len);
+  memcpy(RTA_DATA(rta), data, data_len);
+  nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+// starts a route message at the end of the batch,
+// flushing first if it might not fit
+static struct nlmsghdr *nl_begin_route(nl_fib_t *fib, uint16_t type,
+                                       uint16_t flags, nl_op_t op,
+                                       ip_subnet_t dest) {
+  if (fib->len + NL_ROUTE_MSG_MAX > NL_BATCH_SIZE) {
+    nl_fib_flush(fib);
+  }
+
+  struct nlmsghdr *nlh = (struct nlmsghdr *)(fib->buf + fib->len);
+  memset(nlh, 0, NL_ROUTE_MSG_MAX);
+  nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+  nlh->nlmsg_type = type;
+  nlh->nlmsg_flags = flags;
+  nlh->nlmsg_seq = fib->seq++;
+
+  struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(nlh);
+  rtm->rtm_family = AF_INET;
+  rtm->rtm_dst_len = dest.prefix_len;
+  rtm->rtm_table = RT_TABLE_MAIN;
+
+  nl_pending_t *pending = &fib->pending[nlh->nlmsg_seq % NL_PENDING_LEN];
+  pending->seq = nlh->nlmsg_seq;
+  pending->op = op;
+  pending->dest = dest;
+
+  nl_add_attr(nlh, RTA_DST, &dest.addr, sizeof(dest.addr));
+  return nlh;
+}
+
+// a single gateway is a plain RTA_GATEWAY route, more
+// become one multipath route with a nexthop per gateway
+bool nl_fib_replace(nl_fib_t *fib, ip_subnet_t dest,
+                    const ip_addr_t *gateways, uint8_t n_gateways) {
+  if (n_gateways == 0 || n_gateways > DV_MAX_PATHS) {
+    return false;
+  }
+
+  struct nlmsghdr *nlh =
+      nl_begin_route(fib, RTM_NEWROUTE,
+                     NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE,
+                     NL_OP_REPLACE, dest);
+
+  struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(nlh);
+  rtm->rtm_protocol = NL_RTPROT_DV;
+  rtm->rtm_scope = RT_SCOPE_UNIVERSE;
+  rtm->rtm_type = RTN_UNICAST;
+
+  if (n_gateways == 1) {
+    nl_add_attr(nlh, RTA_GATEWAY, &gateways[0], sizeof(gateways[0]));
+  } else {
+    struct rtattr *multipath =
+        (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    multipath->rta_type = RTA_MULTIPATH;
+    multipath->rta_len = RTA_LENGTH(0);
+
+    for (uint8_t i = 0; i < n_gateways; i++) {
+      struct rtnexthop *rtnh =
+          (struct rtnexthop *)((char *)multipath +
+                               RTA_ALIGN(multipath->rta_len));
+      memset(rtnh, 0, sizeof(*rtnh));
+
+      struct rtattr *gw = (struct rtattr *)RTNH_DATA(rtnh);
+      gw->rta_type = RTA_GATEWAY;
+      gw->rta_len = RTA_LENGTH(sizeof(gateways[i]));
+      memcpy(RTA_DATA(gw), &gateways[i], sizeof(gateways[i]));
+
+      rtnh->rtnh_len = RTNH_LENGTH(RTA_ALIGN(gw->rta_len));
+      multipath->rta_len = RTA_ALIGN(multipath->rta_len) + rtnh->rtnh_len;
+    }
+    nlh->nlmsg_len =
+        NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(multipath->rta_len);
+  }
+
+  fib->len += NLMSG_ALIGN(nlh->nlmsg_len);
+  return true;
+}
+
+bool nl_fib_delete(nl_fib_t *fib, ip_subnet_t dest) {
+  struct nlmsghdr *nlh =
+      nl_begin_route(fib, RTM_DELROUTE, NLM_F_REQUEST, NL_OP_DELETE, dest);
+
+  // the kernel only deletes a route of the given protocol,
+  // so routes this daemon does not own are never touched
+  struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(nlh);
+  rtm->rtm_protocol = NL_RTPROT_DV;
+  rtm->rtm_scope = RT_SCOPE_NOWHERE;
+
+  fib->len += NLMSG_ALIGN(nlh->nlmsg_len);
+  return true;
+}
+
+// sends every queued route message in one datagram
+int nl_fib_flush(nl_fib_t *fib) {
+  if (fib->len == 0) {
+    return 0;
+  }
+
+  struct sockaddr_nl kernel;
+  memset(&kernel, 0, sizeof(kernel));
+  kernel.nl_family = AF_NETLINK;
+
+  struct iovec iov = {fib->buf, fib->len};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &kernel;
+  msg.msg_namelen = sizeof(kernel);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  ssize_t n;
+  do {
+    n = sendmsg(fib->fd, &msg, 0);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) {
+    LOG_ERROR("netlink sendmsg failed: %s", strerror(errno));
+    fib->len = 0;
+    return -1;
+  }
+
+  fib->sent++;
+  fib->len = 0;
+  return (int)n;
+}
+
+static void nl_report_error(nl_fib_t *fib, uint32_t seq, int error) {
+  fib->errors++;
+
+  nl_pending_t *pending = &fib->pending[seq % NL_PENDING_LEN];
+  const char *op = pending->op == NL_OP_REPLACE ? "replace" : "delete";
+
+  if (pending->seq != seq) {
+    LOG_ERROR("route request %u failed: %s", seq, strerror(error));
+    return;
+  }
+  char *dest_str = get_str_from_subnet(pending->dest);
+  if (pending->op == NL_OP_DELETE && error == ESRCH) {
+    // the route was already gone, nothing is left to undo
+    LOG_DEBUG("route %s %s failed: %s", op, dest_str, strerror(error));
+  } else {
+    LOG_ERROR("route %s %s failed: %s", op, dest_str, strerror(error));
+  }
+  free(dest_str);
+}
+
+// drains pending error replies without blocking,
+// returns the number of failed requests seen
+size_t nl_fib_poll_errors(nl_fib_t *fib) {
+  char buf[8192];
+  size_t failed = 0;
+
+  while (true) {
+    ssize_t n = recv(fib->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == ENOBUFS) {
+        // replies were dropped, the counts are a lower bound
+        LOG_ERROR("netlink error replies overflowed");
+        continue;
+      }
+      break;
+    }
+
+    int len = (int)n;
+    for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_type != NLMSG_ERROR) {
+        continue;
+      }
+      struct nlmsgerr *err = (struct nlmsgerr *)NLMSG_DATA(nlh);
+      if (err->error != 0) {
+        nl_report_error(fib, err->msg.nlmsg_seq, -err->error);
+        failed++;
+      }
+    }
+  }
+  return failed;
+}
+
+static void nl_parse_multipath(struct rtattr *multipath, nl_route_t *route) {
+  int len = RTA_PAYLOAD(multipath);
+  struct rtnexthop *rtnh = (struct rtnexthop *)RTA_DATA(multipath);
+
+  while (RTNH_OK(rtnh, len) && route->n_gateways < DV_MAX_PATHS) {
+    int attr_len = rtnh->rtnh_len - sizeof(*rtnh);
+    for (struct rtattr *rta = RTNH_DATA(rtnh); RTA_OK(rta, attr_len);
+         rta = RTA_NEXT(rta, attr_len)) {
+      if (rta->rta_type == RTA_GATEWAY) {
+        memcpy(&route->gateways[route->n_gateways++], RTA_DATA(rta),
+               sizeof(ip_addr_t));
+        break;
+      }
+    }
+    len -= RTNH_ALIGN(rtnh->rtnh_len);
+    rtnh = RTNH_NEXT(rtnh);
+  }
+}
+
+// dumps the IPv4 main table and returns the gateway routes
+// tagged with NL_RTPROT_DV, the caller frees *routes
+size_t nl_fib_dump_owned(nl_fib_t *fib, nl_route_t **routes) {
+  *routes = NULL;
+  nl_fib_flush(fib);
+
+  struct {
+    struct nlmsghdr nlh;
+    struct rtmsg rtm;
+  } req;
+  memset(&req, 0, sizeof(req));
+  req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+  req.nlh.nlmsg_type = RTM_GETROUTE;
+  req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.nlh.nlmsg_seq = fib->seq++;
+  req.rtm.rtm_family = AF_INET;
+
+  if (send(fib->fd, &req, req.nlh.nlmsg_len, 0) < 0) {
+    LOG_ERROR("netlink route dump failed: %s", strerror(errno));
+    return 0;
+  }
+
+  size_t count = 0;
+  size_t capacity = 0;
+  char *buf = (char *)malloc(NL_BATCH_SIZE);
+  bool done = false;
+
+  while (!done) {
+    ssize_t n = recv(fib->fd, buf, NL_BATCH_SIZE, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    int len = (int)n;
+    for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+      if (nlh->nlmsg_seq != req.nlh.nlmsg_seq) {
+        continue;
+      }
+      if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) {
+        done = true;
+        break;
+      }
+      if (nlh->nlmsg_type != RTM_NEWROUTE) {
+        continue;
+      }
+
+      struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(nlh);
+      if (rtm->rtm_protocol != NL_RTPROT_DV ||
+          rtm->rtm_table != RT_TABLE_MAIN) {
+        continue;
+      }
+
+      nl_route_t route;
+      memset(&route, 0, sizeof(route));
+      route.dest.prefix_len = rtm->rtm_dst_len;
+
+      int attr_len = RTM_PAYLOAD(nlh);
+      for (struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, attr_len);
+           rta = RTA_NEXT(rta, attr_len)) {
+        if (rta->rta_type == RTA_DST) {
+          memcpy(&route.dest.addr, RTA_DATA(rta), sizeof(route.dest.addr));
+        } else if (rta->rta_type == RTA_GATEWAY) {
+          memcpy(&route.gateways[0], RTA_DATA(rta), sizeof(ip_addr_t));
+          route.n_gateways = 1;
+        } else if (rta->rta_type == RTA_MULTIPATH) {
+          nl_parse_multipath(rta, &route);
+        }
+      }
+      if (route.n_gateways == 0) {
+        continue;
+      }
+
+      if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        *routes = (nl_route_t *)realloc(*routes, capacity * sizeof(**routes));
+      }
+      (*routes)[count++] = route;
+    }
+  }
+
+  free(buf);
+  return count;
+}
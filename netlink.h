@@ -0,0 +1,64 @@
+#ifndef NETLINK_H_INCLUDED
+#define NETLINK_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#include "network.h"
+
+// bytes of route messages batched per sendmsg
+#define NL_BATCH_SIZE (64 * 1024)
+
+// requests remembered for error reporting,
+// indexed by sequence number
+#define NL_PENDING_LEN 4096
+
+// route protocol id marking the routes this daemon owns
+#define NL_RTPROT_DV 200
+
+typedef enum { NL_OP_REPLACE, NL_OP_DELETE } nl_op_t;
+
+typedef struct nl_route_t {
+  ip_subnet_t dest;
+  uint8_t n_gateways;
+  ip_addr_t gateways[DV_MAX_PATHS];
+} nl_route_t;
+
+typedef struct nl_pending_t {
+  uint32_t seq;
+  nl_op_t op;
+  ip_subnet_t dest;
+} nl_pending_t;
+
+// persistent NETLINK_ROUTE socket batching route
+// changes, success acks are suppressed so only
+// failed requests come back as NLMSG_ERROR
+typedef struct nl_fib_t {
+  int fd;
+  uint32_t seq;
+
+  char *buf;
+  size_t len;
+
+  nl_pending_t pending[NL_PENDING_LEN];
+
+  size_t sent;
+  size_t errors;
+} nl_fib_t;
+
+nl_fib_t *nl_fib_open(void);
+
+void nl_fib_close(nl_fib_t *fib);
+
+bool nl_fib_replace(nl_fib_t *fib, ip_subnet_t dest,
+                    const ip_addr_t *gateways, uint8_t n_gateways);
+
+bool nl_fib_delete(nl_fib_t *fib, ip_subnet_t dest);
+
+int nl_fib_flush(nl_fib_t *fib);
+
+size_t nl_fib_poll_errors(nl_fib_t *fib);
+
+size_t nl_fib_dump_owned(nl_fib_t *fib, nl_route_t **routes);
+
+#endif
@@ -4,6 +4,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "lpm.h"
 #include "network.h"
 
 ip_addr_t get_addr_from_str(char *str) {
@@ -78,119 +85,995 @@ int netmask_to_prefix(char *netmask_str) {
   return prefix;
 }
 
-char *get_distance_vector(dv_table_t *table, ip_addr_t sender) {
-  size_t buffer_len = 128;
-  size_t current_len = 0;
+#define DV_INDEX_MIN_CAPACITY 64
 
-  char *buffer = (char *)malloc(buffer_len * sizeof(*buffer));
+uint64_t subnet_key(ip_subnet_t subnet) {
+  uint32_t addr = ((uint32_t)subnet.addr.f1 << 24) |
+                  ((uint32_t)subnet.addr.f2 << 16) |
+                  ((uint32_t)subnet.addr.f3 << 8) | (uint32_t)subnet.addr.f4;
+  return ((uint64_t)addr << 8) | subnet.prefix_len;
+}
 
-  char *sender_ip_str = get_str_from_addr(sender);
-  size_t header_len = snprintf(buffer, buffer_len, "%s:DV:", sender_ip_str);
-  current_len += header_len;
-  free(sender_ip_str);
+size_t subnet_key_hash(uint64_t key, size_t capacity) {
+  // fibonacci hashing, capacity is a power of two and the slot
+  // comes from the top bits, where every bit of the key mixes in,
+  // the fold first spreads prefixes that step by a whole octet
+  int bits = __builtin_ctzll(capacity);
+  if (bits == 0) {
+    return 0;
+  }
+  key ^= key >> 20;
+  return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
 
-  dv_dest_entry_t *current_entry = table->head;
-  // walk dv entry linked list
-  while (current_entry != NULL) {
-    char *subnet_str = get_str_from_subnet(current_entry->dest);
-    size_t entry_len = strlen(subnet_str) + 8;
+static void dv_index_put(dv_dest_index_t *index, uint64_t key,
+                         dv_dest_entry_t *dest) {
+  size_t i = subnet_key_hash(key, index->capacity);
+  while (index->slots[i].dest != NULL) {
+    i = (i + 1) & (index->capacity - 1);
+  }
+  index->slots[i].key = key;
+  index->slots[i].dest = dest;
+  index->count++;
+}
 
-    if (current_len + entry_len >= buffer_len) {
-      buffer_len = buffer_len * 2 + entry_len;
-      char *new_buffer = (char *)realloc(buffer, buffer_len);
-      buffer = new_buffer;
-    }
+static void dv_index_grow(dv_dest_index_t *index) {
+  dv_index_slot_t *old_slots = index->slots;
+  size_t old_capacity = index->capacity;
 
-    size_t char_written =
-        snprintf(buffer + current_len, buffer_len - current_len,
-                 "(%s,%u):", subnet_str, current_entry->best_cost);
+  index->capacity =
+      old_capacity ? old_capacity * 2 : (size_t)DV_INDEX_MIN_CAPACITY;
+  index->slots =
+      (dv_index_slot_t *)calloc(index->capacity, sizeof(*index->slots));
+  index->count = 0;
 
-    if (char_written > 0) {
-      current_len += char_written;
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old_slots[i].dest != NULL) {
+      dv_index_put(index, old_slots[i].key, old_slots[i].dest);
     }
+  }
+  free(old_slots);
+}
 
-    current_entry = current_entry->next;
+dv_dest_entry_t *dv_find_dest(dv_table_t *table, ip_subnet_t subnet) {
+  dv_dest_index_t *index = &table->index;
+  if (index->count == 0) {
+    return NULL;
   }
 
-  return buffer;
+  uint64_t key = subnet_key(subnet);
+  size_t i = subnet_key_hash(key, index->capacity);
+  while (index->slots[i].dest != NULL) {
+    if (index->slots[i].key == key) {
+      return index->slots[i].dest;
+    }
+    i = (i + 1) & (index->capacity - 1);
+  }
+  return NULL;
 }
 
-dv_parsed_msg_t *parse_distance_vector(char *dv_str,
-                                       pthread_mutex_t *cout_mutex) {
-  if (!dv_str) {
+dv_dest_entry_t *dv_insert_dest(dv_table_t *table, ip_subnet_t subnet) {
+  dv_dest_entry_t *dest = dv_find_dest(table, subnet);
+  if (dest != NULL) {
+    return dest;
+  }
+
+  dest = (dv_dest_entry_t *)slab_alloc(&table->dest_pool);
+  if (!dest) {
     return NULL;
   }
-  char *cursor = dv_str;
+  dest->dest = subnet;
+  dest->best = DV_NO_NEIGHBOR;
+  dest->best_cost = INFINITY_COST;
+  dest->best_mask = 0;
+  dest->installed = 0;
+  dest->known = 0;
+  dest->dirty = false;
+  dest->adopted = false;
+  dest->dirty_next = NULL;
+  memset(dest->costs, INFINITY_COST, sizeof(dest->costs));
+
+  // Insert at head
+  dest->next = table->head;
+  table->head = dest;
+  table->generation++;
+
+  // keep load factor below 1/2
+  dv_dest_index_t *index = &table->index;
+  if ((index->count + 1) * 2 > index->capacity) {
+    dv_index_grow(index);
+  }
+  dv_index_put(index, subnet_key(subnet), dest);
 
-  dv_parsed_msg_t *msg_ll = (dv_parsed_msg_t *)malloc(sizeof(*msg_ll));
-  msg_ll->head = NULL;
-  msg_ll->sender = (ip_addr_t){0, 0, 0, 0};
+  return dest;
+}
 
-  cursor = strchr(dv_str, ':');
-  if (!cursor) {
-    free_parsed_msg(msg_ll);
-    return NULL;
+uint8_t dv_find_neighbor(dv_table_t *table, ip_addr_t addr) {
+  for (uint8_t i = 0; i < table->neighbor_count; i++) {
+    if (addr_cmpr(table->neighbors[i], addr)) {
+      return i;
+    }
   }
+  return DV_NO_NEIGHBOR;
+}
 
-  size_t sender_len = cursor - dv_str;
-  char *sender_ip_buff = (char *)malloc(sender_len + 1);
-  memcpy(sender_ip_buff, dv_str, sender_len);
-  sender_ip_buff[sender_len] = '\0';
+// a slot is free once its neighbor is down, no destination knows
+// a route through it and none is installed through it, its cost
+// column is then all INFINITY_COST, the direct neighbor is never
+// given away
+static bool dv_neighbor_free(dv_table_t *table, uint8_t i) {
+  return (table->down & (1ULL << i)) && table->routes[i].count == 0 &&
+         table->installed_refs[i] == 0 &&
+         !addr_cmpr(table->neighbors[i], (ip_addr_t){0, 0, 0, 0});
+}
 
-  msg_ll->sender = get_addr_from_str(sender_ip_buff);
-  free(sender_ip_buff);
+uint8_t dv_intern_neighbor(dv_table_t *table, ip_addr_t addr) {
+  uint8_t i = dv_find_neighbor(table, addr);
+  if (i != DV_NO_NEIGHBOR) {
+    return i;
+  }
+  // reuse the slot of a neighbor that has gone away
+  for (i = 0; i < table->neighbor_count; i++) {
+    if (dv_neighbor_free(table, i)) {
+      table->neighbors[i] = addr;
+      table->down &= ~(1ULL << i);
+      return i;
+    }
+  }
+  if (table->neighbor_count >= DV_MAX_NEIGHBORS) {
+    return DV_NO_NEIGHBOR;
+  }
+  table->neighbors[table->neighbor_count] = addr;
+  return table->neighbor_count++;
+}
 
-  cursor++;
-  if (strncmp(cursor, "DV:", 3) != 0) {
-    free_parsed_msg(msg_ll);
-    return NULL;
+// returns the bitmask of neighbors sharing the minimum
+// cost in a cost row, rows are padded with INFINITY_COST
+// so reading whole 16 byte blocks past count is safe
+uint64_t dv_min_cost_mask(const uint8_t *costs, uint8_t count,
+                          uint8_t *min_cost) {
+  size_t n = ((size_t)count + 15) & ~(size_t)15;
+  uint64_t mask = 0;
+
+#if defined(__SSE2__)
+  __m128i min_v = _mm_set1_epi8(INFINITY_COST);
+  for (size_t i = 0; i < n; i += 16) {
+    min_v = _mm_min_epu8(min_v, _mm_loadu_si128((const __m128i *)(costs + i)));
+  }
+  min_v = _mm_min_epu8(min_v, _mm_srli_si128(min_v, 8));
+  min_v = _mm_min_epu8(min_v, _mm_srli_si128(min_v, 4));
+  min_v = _mm_min_epu8(min_v, _mm_srli_si128(min_v, 2));
+  min_v = _mm_min_epu8(min_v, _mm_srli_si128(min_v, 1));
+  uint8_t min = (uint8_t)_mm_cvtsi128_si32(min_v);
+
+  if (min < INFINITY_COST) {
+    __m128i target = _mm_set1_epi8((char)min);
+    for (size_t i = 0; i < n; i += 16) {
+      __m128i row = _mm_loadu_si128((const __m128i *)(costs + i));
+      uint32_t eq = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(row, target));
+      mask |= (uint64_t)eq << i;
+    }
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  uint8x16_t min_v = vdupq_n_u8(INFINITY_COST);
+  for (size_t i = 0; i < n; i += 16) {
+    min_v = vminq_u8(min_v, vld1q_u8(costs + i));
   }
-  cursor += 3;
+  uint8_t min = vminvq_u8(min_v);
+
+  if (min < INFINITY_COST) {
+    uint8x16_t target = vdupq_n_u8(min);
+    for (size_t i = 0; i < n; i += 16) {
+      // narrow each byte compare result to a nibble
+      uint8x16_t eq = vceqq_u8(vld1q_u8(costs + i), target);
+      uint64_t nibbles = vget_lane_u64(
+          vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+      nibbles &= 0x1111111111111111ULL;
+      while (nibbles != 0) {
+        mask |= 1ULL << (i + __builtin_ctzll(nibbles) / 4);
+        nibbles &= nibbles - 1;
+      }
+    }
+  }
+#else
+  uint8_t min = INFINITY_COST;
+  for (size_t i = 0; i < n; i++) {
+    if (costs[i] < min) {
+      min = costs[i];
+    }
+  }
+  if (min < INFINITY_COST) {
+    for (size_t i = 0; i < n; i++) {
+      if (costs[i] == min) {
+        mask |= 1ULL << i;
+      }
+    }
+  }
+#endif
 
-  while (*cursor == '(') {
-    pthread_mutex_lock(cout_mutex);
-    // std::cout << "~~Parsing new destination" << std::endl;
-    pthread_mutex_unlock(cout_mutex);
-    cursor++;
-    char *close_paren = strchr(cursor, ')');
-    char *comma = strchr(cursor, ',');
+  *min_cost = min < INFINITY_COST ? min : INFINITY_COST;
+  return mask;
+}
 
-    size_t subnet_len = comma - cursor;
-    char *subnet_buff = (char *)malloc(subnet_len + 1);
-    memcpy(subnet_buff, cursor, subnet_len);
-    subnet_buff[subnet_len] = '\0';
+// keeps up to max_paths of the tied neighbors in mask,
+// preferring the ones already in use so existing next
+// hops stay put as other neighbors come and go
+static uint64_t dv_limit_paths(uint64_t mask, uint64_t current,
+                               uint8_t max_paths) {
+  uint64_t kept = 0;
+  uint8_t count = 0;
+
+  uint64_t candidates = mask & current;
+  while (candidates != 0 && count < max_paths) {
+    kept |= candidates & -candidates;
+    candidates &= candidates - 1;
+    count++;
+  }
+  candidates = mask & ~current;
+  while (candidates != 0 && count < max_paths) {
+    kept |= candidates & -candidates;
+    candidates &= candidates - 1;
+    count++;
+  }
+  return kept;
+}
 
-    ip_subnet_t subnet = get_subnet_from_str(subnet_buff);
-    free(subnet_buff);
-    cursor = comma + 1;
+bool dv_select_best(dv_table_t *table, dv_dest_entry_t *dest) {
+  uint8_t min_cost;
+  uint64_t mask =
+      dv_min_cost_mask(dest->costs, table->neighbor_count, &min_cost);
+  mask = dv_limit_paths(mask, dest->best_mask, table->max_paths);
+  uint8_t best = mask ? (uint8_t)__builtin_ctzll(mask) : DV_NO_NEIGHBOR;
 
-    uint32_t cost = (uint32_t)strtoul(cursor, NULL, 10);
+  // keep the current best on a tie to avoid flapping
+  if (dest->best != DV_NO_NEIGHBOR && (mask & (1ULL << dest->best))) {
+    best = dest->best;
+  }
 
-    dv_parsed_entry_t *entry = (dv_parsed_entry_t *)malloc(sizeof(*entry));
-    entry->dest = subnet;
-    entry->cost = cost;
-    entry->next = msg_ll->head;
-    msg_ll->head = entry;
+  if (dest->best == best && dest->best_cost == min_cost &&
+      dest->best_mask == mask) {
+    return false;
+  }
 
-    cursor = close_paren + 2;
+  // keep the lpm view in step with next hop changes
+  if (table->fib != NULL && dest->best != best) {
+    if (best != DV_NO_NEIGHBOR) {
+      // out of memory, a missing route beats a stale next hop
+      if (!lpm_insert(table->fib, dest->dest, table->neighbors[best])) {
+        lpm_remove(table->fib, dest->dest);
+      }
+    } else {
+      lpm_remove(table->fib, dest->dest);
+    }
   }
-  return msg_ll;
+
+  if (dest->best_cost != min_cost) {
+    table->generation++;
+  }
+  dest->best = best;
+  dest->best_cost = min_cost;
+  dest->best_mask = mask;
+
+  // changes both the advertised vector and the kernel view
+  dv_mark_dirty(table, dest);
+  table->last_change = time(NULL);
+  return true;
 }
 
-void free_parsed_msg(dv_parsed_msg_t *msg) {
-  if (!msg) {
-    return;
+bool dv_set_cost(dv_table_t *table, dv_dest_entry_t *dest, uint8_t neighbor,
+                 uint8_t cost) {
+  if (cost > INFINITY_COST) {
+    cost = INFINITY_COST;
+  }
+  if (!(dest->known & (1ULL << neighbor))) {
+    dest->known |= 1ULL << neighbor;
+    dv_dest_list_push(&table->routes[neighbor], dest);
+  }
+  // relearned, from now on it is advertised like any other
+  if (dest->adopted) {
+    dest->adopted = false;
+    table->generation++;
+  }
+  if (cost < INFINITY_COST) {
+    table->down &= ~(1ULL << neighbor);
+  }
+
+  uint8_t old_cost = dest->costs[neighbor];
+  if (old_cost == cost) {
+    return false;
   }
-  dv_parsed_entry_t *current_entry = msg->head;
-  while (current_entry != NULL) {
-    dv_parsed_entry_t *next_entry = current_entry->next;
-    free(current_entry);
-    current_entry = next_entry;
+  dest->costs[neighbor] = cost;
+
+  // only a better or tied route, or a change to a current
+  // next hop can move the selection
+  if (cost <= dest->best_cost || (dest->best_mask & (1ULL << neighbor))) {
+    return dv_select_best(table, dest);
   }
-  free(msg);
+  return false;
+}
+
+void dv_dest_list_push(dv_dest_list_t *list, dv_dest_entry_t *dest) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 16;
+    list->items = (dv_dest_entry_t **)realloc(
+        list->items, list->capacity * sizeof(*list->items));
+  }
+  list->items[list->count++] = dest;
+}
+
+void dv_dest_list_free(dv_dest_list_t *list) {
+  free(list->items);
+  list->items = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+// sets every route learned via addr to INFINITY_COST,
+// touching only the destinations in its reverse index,
+// changed destinations land on the dirty list, then the
+// routes are forgotten so the slot can be reused
+size_t dv_invalidate_neighbor(dv_table_t *table, ip_addr_t addr) {
+  uint8_t neighbor = dv_find_neighbor(table, addr);
+  if (neighbor == DV_NO_NEIGHBOR || (table->down & (1ULL << neighbor))) {
+    return 0;
+  }
+  table->down |= 1ULL << neighbor;
+
+  size_t n_changed = 0;
+  dv_dest_list_t *routes = &table->routes[neighbor];
+  for (size_t i = 0; i < routes->count; i++) {
+    dv_dest_entry_t *dest = routes->items[i];
+    if (dv_set_cost(table, dest, neighbor, INFINITY_COST)) {
+      n_changed++;
+    }
+    dest->known &= ~(1ULL << neighbor);
+  }
+  dv_dest_list_free(routes);
+  return n_changed;
+}
+
+// records the next hop set handed to the kernel, keeping
+// the per neighbor counts of installed routes in step, a
+// gateway only ever seen in the kernel is down once its
+// last route is gone
+void dv_set_installed(dv_table_t *table, dv_dest_entry_t *dest,
+                      uint64_t mask) {
+  uint64_t changed = dest->installed ^ mask;
+  while (changed != 0) {
+    int i = __builtin_ctzll(changed);
+    if (mask & (1ULL << i)) {
+      table->installed_refs[i]++;
+    } else if (--table->installed_refs[i] == 0 &&
+               table->routes[i].count == 0) {
+      table->down |= 1ULL << i;
+    }
+    changed &= changed - 1;
+  }
+  dest->installed = mask;
+}
+
+// drops the directly connected route to subnet
+bool dv_invalidate_connected(dv_table_t *table, ip_subnet_t subnet) {
+  uint8_t direct = dv_find_neighbor(table, (ip_addr_t){0, 0, 0, 0});
+  dv_dest_entry_t *dest = dv_find_dest(table, subnet);
+  if (direct == DV_NO_NEIGHBOR || dest == NULL ||
+      !(dest->known & (1ULL << direct))) {
+    return false;
+  }
+
+  return dv_set_cost(table, dest, direct, INFINITY_COST);
+}
+
+// queues dest for the next sync, at most once
+void dv_mark_dirty(dv_table_t *table, dv_dest_entry_t *dest) {
+  if (!dest->dirty) {
+    dest->dirty = true;
+    dest->dirty_next = table->dirty_head;
+    table->dirty_head = dest;
+    table->dirty_count++;
+  }
+}
+
+// detaches the dirty list, the caller walks it through
+// dirty_next and clears each entry's dirty flag
+dv_dest_entry_t *dv_take_dirty(dv_table_t *table) {
+  dv_dest_entry_t *head = table->dirty_head;
+  table->dirty_head = NULL;
+  table->dirty_count = 0;
+  return head;
+}
+
+bool dv_lookup(dv_table_t *table, ip_addr_t addr, ip_addr_t *next_hop) {
+  pthread_mutex_lock(table->table_mutex);
+  bool found = lpm_lookup(table->fib, addr, next_hop);
+  pthread_mutex_unlock(table->table_mutex);
+  return found;
+}
+
+size_t dv_lookup_batch(dv_table_t *table, const ip_addr_t *addrs,
+                       size_t count, ip_addr_t *next_hops, bool *found) {
+  pthread_mutex_lock(table->table_mutex);
+  size_t n_found = lpm_lookup_batch(table->fib, addrs, count, next_hops, found);
+  pthread_mutex_unlock(table->table_mutex);
+  return n_found;
+}
+
+// longest entry: "(255.255.255.255/32,16):"
+#define DV_ENTRY_MAX 24
+
+static char *put_decimal(char *out, unsigned value) {
+  if (value >= 100) {
+    *out++ = '0' + value / 100;
+  }
+  if (value >= 10) {
+    *out++ = '0' + value / 10 % 10;
+  }
+  *out++ = '0' + value % 10;
+  return out;
+}
+
+static char *put_addr(char *out, ip_addr_t addr) {
+  out = put_decimal(out, addr.f1);
+  *out++ = '.';
+  out = put_decimal(out, addr.f2);
+  *out++ = '.';
+  out = put_decimal(out, addr.f3);
+  *out++ = '.';
+  return put_decimal(out, addr.f4);
+}
+
+void dv_encoding_init(dv_encoding_t *enc) {
+  enc->body = NULL;
+  enc->len = 0;
+  enc->capacity = 0;
+  enc->flags = 0;
+  enc->sorted = NULL;
+  enc->sorted_capacity = 0;
+  enc->chunk_ends = NULL;
+  enc->chunk_count = 0;
+  enc->chunk_capacity = 0;
+  // never matches a table, the first dv_encode always encodes
+  enc->generation = UINT64_MAX;
+}
+
+void dv_encoding_free(dv_encoding_t *enc) {
+  free(enc->body);
+  free(enc->sorted);
+  free(enc->chunk_ends);
+  dv_encoding_init(enc);
+}
+
+// returns a reference to the current advertised vector, copying
+// it out only if the table changed since the last snapshot,
+// caller holds table_mutex and releases the reference
+dv_snapshot_t *dv_snapshot_take(dv_table_t *table) {
+  dv_snapshot_t *snap = table->advertised;
+  if (snap == NULL || snap->generation != table->generation) {
+    // the index counts every destination in the list
+    size_t count = table->index.count;
+    snap = (dv_snapshot_t *)malloc(sizeof(*snap) +
+                                   count * sizeof(*snap->routes));
+    if (!snap) {
+      return NULL;
+    }
+    snap->refs = 1;
+    snap->generation = table->generation;
+    snap->routes = (dv_advert_t *)(snap + 1);
+    snap->count = 0;
+    dv_dest_entry_t *dest = table->head;
+    while (dest != NULL && snap->count < count) {
+      // an adopted route advertised at INFINITY_COST would make
+      // neighbors drop their own routes through us
+      if (dest->adopted) {
+        dest = dest->next;
+        continue;
+      }
+      snap->routes[snap->count].dest = dest->dest;
+      snap->routes[snap->count].cost = dest->best_cost;
+      snap->count++;
+      dest = dest->next;
+    }
+
+    // the table holds one reference until it is replaced
+    if (table->advertised) {
+      dv_snapshot_release(table->advertised);
+    }
+    table->advertised = snap;
+  }
+  __atomic_fetch_add(&snap->refs, 1, __ATOMIC_RELAXED);
+  return snap;
+}
+
+void dv_snapshot_release(dv_snapshot_t *snap) {
+  if (__atomic_sub_fetch(&snap->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(snap);
+  }
+}
+
+// closes the current chunk of enc at offset end, false once
+// the body needs more chunks than a header can count
+static bool dv_close_chunk(dv_encoding_t *enc, size_t end) {
+  if (enc->chunk_count == DV_CHUNK_MAX) {
+    return false;
+  }
+  if (enc->chunk_count == enc->chunk_capacity) {
+    size_t capacity = enc->chunk_capacity ? enc->chunk_capacity * 2 : 16;
+    size_t *ends =
+        (size_t *)realloc(enc->chunk_ends, capacity * sizeof(*ends));
+    if (!ends) {
+      return false;
+    }
+    enc->chunk_ends = ends;
+    enc->chunk_capacity = capacity;
+  }
+  enc->chunk_ends[enc->chunk_count++] = end;
+  return true;
+}
+
+// brings enc up to date with snap, false if the body could
+// not be grown, needs no lock as snap never changes
+bool dv_encode(const dv_snapshot_t *snap, dv_encoding_t *enc) {
+  if (enc->generation == snap->generation) {
+    return true;
+  }
+
+  size_t needed = snap->count * DV_ENTRY_MAX + 1;
+  if (needed > enc->capacity) {
+    char *body = (char *)realloc(enc->body, needed);
+    if (!body) {
+      return false;
+    }
+    enc->body = body;
+    enc->capacity = needed;
+  }
+
+  // entries never straddle a chunk, each is a valid text DV body
+  enc->chunk_count = 0;
+  char *out = enc->body;
+  char *chunk_start = enc->body;
+  for (size_t i = 0; i < snap->count; i++) {
+    const dv_advert_t *route = &snap->routes[i];
+    char *entry = out;
+    *out++ = '(';
+    out = put_addr(out, route->dest.addr);
+    *out++ = '/';
+    out = put_decimal(out, route->dest.prefix_len);
+    *out++ = ',';
+    out = put_decimal(out, route->cost);
+    *out++ = ')';
+    *out++ = ':';
+    if (out - chunk_start > DV_CHUNK_BODY && entry > chunk_start) {
+      if (!dv_close_chunk(enc, entry - enc->body)) {
+        return false;
+      }
+      chunk_start = entry;
+    }
+  }
+  *out = '\0';
+
+  enc->len = out - enc->body;
+  if (!dv_close_chunk(enc, enc->len)) {
+    return false;
+  }
+  enc->generation = snap->generation;
+  return true;
+}
+
+// writes the "sender:DV:" header of one chunk of enc into buf of
+// DV_HEADER_MAX bytes, "sender:DVC:generation:index:count:" if
+// the DV did not fit a single datagram
+size_t dv_encode_header(ip_addr_t sender, const dv_encoding_t *enc,
+                        size_t chunk, char *buf) {
+  char *out = put_addr(buf, sender);
+  if (enc->chunk_count == 1) {
+    memcpy(out, ":DV:", 5);
+    return out + 4 - buf;
+  }
+  int n = snprintf(out, DV_HEADER_MAX - (out - buf), ":DVC:%u:%zu:%zu:",
+                   (uint32_t)enc->generation, chunk, enc->chunk_count);
+  return out + n - buf;
+}
+
+static uint32_t addr_to_u32(ip_addr_t addr) {
+  return (uint32_t)addr.f1 << 24 | (uint32_t)addr.f2 << 16 |
+         (uint32_t)addr.f3 << 8 | addr.f4;
+}
+
+static ip_addr_t u32_to_addr(uint32_t value) {
+  return (ip_addr_t){(uint8_t)(value >> 24), (uint8_t)(value >> 16),
+                     (uint8_t)(value >> 8), (uint8_t)value};
+}
+
+static int advert_cmp(const void *a, const void *b) {
+  const dv_advert_t *x = (const dv_advert_t *)a;
+  const dv_advert_t *y = (const dv_advert_t *)b;
+  uint32_t x_addr = addr_to_u32(x->dest.addr);
+  uint32_t y_addr = addr_to_u32(y->dest.addr);
+  if (x_addr != y_addr) {
+    return x_addr < y_addr ? -1 : 1;
+  }
+  return (int)x->dest.prefix_len - (int)y->dest.prefix_len;
+}
+
+static size_t leb128_len(uint32_t value) {
+  size_t len = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    len++;
+  }
+  return len;
+}
+
+static uint8_t *put_leb128(uint8_t *out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+// binary counterpart of dv_encode, records are delta coded
+// whenever that comes out smaller than fixed size records
+bool dv_encode_binary(const dv_snapshot_t *snap, dv_encoding_t *enc) {
+  if (enc->generation == snap->generation) {
+    return true;
+  }
+
+  if (snap->count > enc->sorted_capacity) {
+    dv_advert_t *sorted = (dv_advert_t *)realloc(
+        enc->sorted, snap->count * sizeof(*enc->sorted));
+    if (!sorted) {
+      return false;
+    }
+    enc->sorted = sorted;
+    enc->sorted_capacity = snap->count;
+  }
+  // sorted stays NULL for an empty table
+  if (snap->count > 0) {
+    memcpy(enc->sorted, snap->routes, snap->count * sizeof(*enc->sorted));
+    qsort(enc->sorted, snap->count, sizeof(*enc->sorted), advert_cmp);
+  }
+
+  size_t delta_len = 0;
+  uint32_t prev = 0;
+  for (size_t i = 0; i < snap->count; i++) {
+    uint32_t addr = addr_to_u32(enc->sorted[i].dest.addr);
+    delta_len += leb128_len(addr - prev) + 2;
+    prev = addr;
+  }
+  size_t plain_len = snap->count * DV_BIN_RECORD_LEN;
+  enc->flags = delta_len < plain_len ? DV_BIN_DELTA : 0;
+
+  // a delta restarting at a chunk boundary takes up to 5 bytes
+  bool delta = enc->flags & DV_BIN_DELTA;
+  size_t needed = (delta ? snap->count * 7 : plain_len) + 1;
+  if (needed > enc->capacity) {
+    char *body = (char *)realloc(enc->body, needed);
+    if (!body) {
+      return false;
+    }
+    enc->body = body;
+    enc->capacity = needed;
+  }
+
+  // deltas restart from zero in every chunk so each decodes alone
+  enc->chunk_count = 0;
+  uint8_t *out = (uint8_t *)enc->body;
+  uint8_t *chunk_start = out;
+  prev = 0;
+  for (size_t i = 0; i < snap->count; i++) {
+    const dv_advert_t *route = &enc->sorted[i];
+    uint32_t addr = addr_to_u32(route->dest.addr);
+    size_t record_len =
+        delta ? leb128_len(addr - prev) + 2 : DV_BIN_RECORD_LEN;
+    if ((size_t)(out - chunk_start) + record_len > DV_CHUNK_BODY &&
+        out > chunk_start) {
+      if (!dv_close_chunk(enc, out - (uint8_t *)enc->body)) {
+        return false;
+      }
+      chunk_start = out;
+      prev = 0;
+    }
+    if (delta) {
+      out = put_leb128(out, addr - prev);
+      prev = addr;
+    } else {
+      *out++ = route->dest.addr.f1;
+      *out++ = route->dest.addr.f2;
+      *out++ = route->dest.addr.f3;
+      *out++ = route->dest.addr.f4;
+    }
+    *out++ = route->dest.prefix_len;
+    *out++ = route->cost;
+  }
+
+  enc->len = out - (uint8_t *)enc->body;
+  if (!dv_close_chunk(enc, enc->len)) {
+    return false;
+  }
+  enc->generation = snap->generation;
+  return true;
+}
+
+static void put_u16(uint8_t *out, uint16_t value) {
+  out[0] = (uint8_t)(value >> 8);
+  out[1] = (uint8_t)value;
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+  put_u16(out, (uint16_t)(value >> 16));
+  put_u16(out + 2, (uint16_t)value);
+}
+
+static uint16_t get_u16(const uint8_t *in) {
+  return (uint16_t)(in[0] << 8 | in[1]);
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+  return (uint32_t)get_u16(in) << 16 | get_u16(in + 2);
+}
+
+// writes the binary header of one chunk of enc into buf of
+// DV_HEADER_MAX bytes
+size_t dv_encode_binary_header(ip_addr_t sender, const dv_encoding_t *enc,
+                               size_t chunk, char *buf) {
+  uint8_t *out = (uint8_t *)buf;
+  bool chunked = enc->chunk_count > 1;
+  out[0] = DV_BIN_MAGIC;
+  out[1] = DV_BIN_VERSION;
+  out[2] = enc->flags | (chunked ? DV_BIN_CHUNKED : 0);
+  out[3] = 0;
+  out[4] = sender.f1;
+  out[5] = sender.f2;
+  out[6] = sender.f3;
+  out[7] = sender.f4;
+  if (!chunked) {
+    return DV_BIN_HEADER_LEN;
+  }
+  put_u32(out + 8, (uint32_t)enc->generation);
+  put_u16(out + 12, (uint16_t)chunk);
+  put_u16(out + 14, (uint16_t)enc->chunk_count);
+  return DV_BIN_HEADER_LEN + DV_BIN_CHUNK_LEN;
+}
+
+// body bytes of one chunk of an encoding
+const char *dv_encoding_chunk(const dv_encoding_t *enc, size_t chunk,
+                              size_t *len) {
+  size_t start = chunk > 0 ? enc->chunk_ends[chunk - 1] : 0;
+  *len = enc->chunk_ends[chunk] - start;
+  return enc->body + start;
+}
+
+// text messages always start with the sender's address
+bool dv_is_binary(const char *msg, size_t len) {
+  return len > 0 && (uint8_t)msg[0] == DV_BIN_MAGIC;
+}
+
+// decodes the binary header and chunk fields, false for an unknown
+// version or flags, a truncated header or an impossible chunk
+static bool read_binary_header(const uint8_t *in, size_t len,
+                               ip_addr_t *sender, dv_chunk_t *chunk,
+                               size_t *header_len) {
+  if (len < DV_BIN_HEADER_LEN || in[0] != DV_BIN_MAGIC ||
+      in[1] != DV_BIN_VERSION ||
+      (in[2] & ~(DV_BIN_DELTA | DV_BIN_CHUNKED)) != 0) {
+    return false;
+  }
+  *sender = (ip_addr_t){in[4], in[5], in[6], in[7]};
+  *chunk = (dv_chunk_t){0, 0, 1};
+  *header_len = DV_BIN_HEADER_LEN;
+  if (!(in[2] & DV_BIN_CHUNKED)) {
+    return true;
+  }
+
+  if (len < DV_BIN_HEADER_LEN + DV_BIN_CHUNK_LEN) {
+    return false;
+  }
+  chunk->generation = get_u32(in + 8);
+  chunk->index = get_u16(in + 12);
+  chunk->count = get_u16(in + 14);
+  *header_len += DV_BIN_CHUNK_LEN;
+  return chunk->index < chunk->count;
+}
+
+// strict decode of a binary DV into out->routes, false for a bad
+// header, a truncated record, a prefix length over 32 or more than
+// max_routes records
+bool parse_distance_vector_binary(const char *msg, size_t len,
+                                  dv_parsed_msg_t *out, size_t max_routes) {
+  const uint8_t *in = (const uint8_t *)msg;
+  const uint8_t *end = in + len;
+  size_t header_len;
+  out->count = 0;
+  if (!read_binary_header(in, len, &out->sender, &out->chunk,
+                          &header_len)) {
+    return false;
+  }
+  bool delta = in[2] & DV_BIN_DELTA;
+  in += header_len;
+
+  uint32_t prev = 0;
+  while (in < end) {
+    uint32_t addr;
+    if (delta) {
+      uint32_t value = 0;
+      int shift = 0;
+      while (true) {
+        if (in == end || shift > 28) {
+          return false;
+        }
+        uint8_t byte = *in++;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+          break;
+        }
+        shift += 7;
+      }
+      addr = prev + value;
+      prev = addr;
+    } else {
+      if (end - in < 4) {
+        return false;
+      }
+      addr = (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 |
+             (uint32_t)in[2] << 8 | in[3];
+      in += 4;
+    }
+    if (end - in < 2 || in[0] > 32 || out->count == max_routes) {
+      return false;
+    }
+
+    dv_advert_t *route = &out->routes[out->count++];
+    route->dest.addr = u32_to_addr(addr);
+    route->dest.prefix_len = in[0];
+    route->cost = in[1];
+    in += 2;
+  }
+  return true;
+}
+
+// text DV scanning, each step checks the cursor against end
+
+static bool scan_char(const char **cursor, const char *end, char c) {
+  if (*cursor == end || **cursor != c) {
+    return false;
+  }
+  (*cursor)++;
+  return true;
+}
+
+// one to three digits, no leading '+' or '-' and at most max
+static bool scan_decimal(const char **cursor, const char *end, unsigned max,
+                         uint8_t *out) {
+  const char *in = *cursor;
+  unsigned value = 0;
+  int digits = 0;
+  while (in < end && *in >= '0' && *in <= '9') {
+    if (++digits > 3) {
+      return false;
+    }
+    value = value * 10 + (*in - '0');
+    in++;
+  }
+  if (digits == 0 || value > max) {
+    return false;
+  }
+  *out = (uint8_t)value;
+  *cursor = in;
+  return true;
+}
+
+static bool scan_addr(const char **cursor, const char *end, ip_addr_t *addr) {
+  return scan_decimal(cursor, end, 255, &addr->f1) &&
+         scan_char(cursor, end, '.') &&
+         scan_decimal(cursor, end, 255, &addr->f2) &&
+         scan_char(cursor, end, '.') &&
+         scan_decimal(cursor, end, 255, &addr->f3) &&
+         scan_char(cursor, end, '.') &&
+         scan_decimal(cursor, end, 255, &addr->f4);
+}
+
+// up to ten digits and at most max, for the chunk fields
+static bool scan_number(const char **cursor, const char *end, uint32_t max,
+                        uint32_t *out) {
+  const char *in = *cursor;
+  uint64_t value = 0;
+  int digits = 0;
+  while (in < end && *in >= '0' && *in <= '9') {
+    if (++digits > 10) {
+      return false;
+    }
+    value = value * 10 + (*in - '0');
+    in++;
+  }
+  if (digits == 0 || value > max) {
+    return false;
+  }
+  *out = (uint32_t)value;
+  *cursor = in;
+  return true;
+}
+
+// "sender:DV:" or "sender:DVC:generation:index:count:"
+static bool scan_text_header(const char **cursor, const char *end,
+                             ip_addr_t *sender, dv_chunk_t *chunk) {
+  *chunk = (dv_chunk_t){0, 0, 1};
+  if (!scan_addr(cursor, end, sender) || !scan_char(cursor, end, ':') ||
+      !scan_char(cursor, end, 'D') || !scan_char(cursor, end, 'V')) {
+    return false;
+  }
+  if (!scan_char(cursor, end, 'C')) {
+    return scan_char(cursor, end, ':');
+  }
+
+  uint32_t index, count;
+  if (!scan_char(cursor, end, ':') ||
+      !scan_number(cursor, end, UINT32_MAX, &chunk->generation) ||
+      !scan_char(cursor, end, ':') ||
+      !scan_number(cursor, end, DV_CHUNK_MAX, &index) ||
+      !scan_char(cursor, end, ':') ||
+      !scan_number(cursor, end, DV_CHUNK_MAX, &count) ||
+      !scan_char(cursor, end, ':') || index >= count) {
+    return false;
+  }
+  chunk->index = (uint16_t)index;
+  chunk->count = (uint16_t)count;
+  return true;
+}
+
+// single pass decode of "a.b.c.d:DV:(a.b.c.d/len,cost):..." into
+// out->routes, false on any malformed or truncated entry or more
+// than max_routes, the final ':' may be missing
+bool parse_distance_vector(const char *msg, size_t len, dv_parsed_msg_t *out,
+                           size_t max_routes) {
+  const char *cursor = msg;
+  const char *end = msg + len;
+  out->count = 0;
+
+  if (!scan_text_header(&cursor, end, &out->sender, &out->chunk)) {
+    return false;
+  }
+
+  while (cursor < end) {
+    if (out->count == max_routes) {
+      return false;
+    }
+    dv_advert_t *route = &out->routes[out->count];
+    if (!scan_char(&cursor, end, '(') ||
+        !scan_addr(&cursor, end, &route->dest.addr) ||
+        !scan_char(&cursor, end, '/') ||
+        !scan_decimal(&cursor, end, 32, &route->dest.prefix_len) ||
+        !scan_char(&cursor, end, ',') ||
+        !scan_decimal(&cursor, end, 255, &route->cost) ||
+        !scan_char(&cursor, end, ')')) {
+      return false;
+    }
+    out->count++;
+    if (cursor < end && !scan_char(&cursor, end, ':')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// decodes only the header of a DV in either format, false if it
+// is malformed
+bool dv_read_chunk(const char *msg, size_t len, dv_chunk_t *chunk) {
+  ip_addr_t sender;
+  if (dv_is_binary(msg, len)) {
+    size_t header_len;
+    return read_binary_header((const uint8_t *)msg, len, &sender, chunk,
+                              &header_len);
+  }
+  const char *cursor = msg;
+  return scan_text_header(&cursor, msg + len, &sender, chunk);
 }
 
 msg_type_t get_msg_type(char *msg) {
+  if ((uint8_t)msg[0] == DV_BIN_MAGIC) {
+    return MSG_DV;
+  }
   char *first_colon = strchr(msg, ':');
   if (!first_colon) {
     return MSG_UNKOWN;
@@ -207,56 +1090,26 @@ msg_type_t get_msg_type(char *msg) {
 
 void add_direct_route(dv_table_t *table, ip_subnet_t subnet, uint32_t cost,
                       pthread_mutex_t *cout_mutex) {
-  dv_dest_entry_t *current_dest = table->head;
-  while (current_dest != NULL) {
-    if (subnet_cmpr(current_dest->dest, subnet))
-      break;
-    current_dest = current_dest->next;
-  }
+  dv_dest_entry_t *current_dest = dv_find_dest(table, subnet);
 
   if (current_dest == NULL) {
-    current_dest = (dv_dest_entry_t *)malloc(sizeof(dv_dest_entry_t));
-    current_dest->dest = subnet;
-    current_dest->head = NULL;
-    current_dest->best = NULL;
-    current_dest->installed = NULL;
-    current_dest->best_cost = INFINITY_COST;
-
-    // Insert at head
-    current_dest->next = table->head;
-    table->head = current_dest;
+    current_dest = dv_insert_dest(table, subnet);
+    if (current_dest == NULL) {
+      return;
+    }
 
     pthread_mutex_lock(cout_mutex);
     char *subnet_str = get_str_from_subnet(subnet);
     std::cout << "Adding new dest: " << subnet_str << std::endl;
+    free(subnet_str);
     pthread_mutex_unlock(cout_mutex);
   }
 
-  ip_addr_t direct_gateway = (ip_addr_t){0, 0, 0, 0};
-
-  dv_neighbor_entry_t *current_neighbor = current_dest->head;
-  while (current_neighbor != NULL) {
-    if (addr_cmpr(current_neighbor->neighbor_addr, direct_gateway))
-      break;
-    current_neighbor = current_neighbor->next;
-  }
-
-  if (current_neighbor == NULL) {
-    current_neighbor =
-        (dv_neighbor_entry_t *)malloc(sizeof(dv_neighbor_entry_t));
-    current_neighbor->neighbor_addr = direct_gateway;
-
-    // Insert at head of neighbors list
-    current_neighbor->next = current_dest->head;
-    current_dest->head = current_neighbor;
-  }
-
-  current_neighbor->cost = cost;
-
-  if (cost < current_dest->best_cost) {
-    current_dest->best_cost = cost;
-    current_dest->best = current_neighbor;
+  uint8_t direct = dv_intern_neighbor(table, (ip_addr_t){0, 0, 0, 0});
+  if (direct == DV_NO_NEIGHBOR) {
+    return;
   }
+  dv_set_cost(table, current_dest, direct, cost);
 }
 
 void dv_update(dv_table_t *table) { table->update_dv = true; }
@@ -279,8 +1132,8 @@ void print_dv_table(dv_table_t *table, pthread_mutex_t *cout_mutex) {
     std::string gw_str = "None";
     std::string cost_str = "INF";
 
-    if (dest->best != NULL) {
-      char *gw_ip = get_str_from_addr(dest->best->neighbor_addr);
+    if (dest->best != DV_NO_NEIGHBOR) {
+      char *gw_ip = get_str_from_addr(table->neighbors[dest->best]);
       gw_str = std::string(gw_ip);
       free(gw_ip);
 
@@ -329,9 +1182,9 @@ void print_routing_table(dv_table_t *table, pthread_mutex_t *cout_mutex) {
     // std::cout << "\n[Destination: " << subnet_str << "]\n";
 
     // Iterate over ALL neighbors for this destination
-    dv_neighbor_entry_t *neigh = dest->head;
+    uint64_t known = dest->known;
 
-    if (neigh == NULL) {
+    if (known == 0) {
       // No routes for this destination
       std::cout << subnet_str << "\t\t"
                 << "---" << "\t\t"
@@ -339,14 +1192,17 @@ void print_routing_table(dv_table_t *table, pthread_mutex_t *cout_mutex) {
                 << "---" << "\n";
     }
 
-    while (neigh != NULL) {
-      char *gw_ip = get_str_from_addr(neigh->neighbor_addr);
+    while (known != 0) {
+      uint8_t neigh = (uint8_t)__builtin_ctzll(known);
+      uint8_t cost = dest->costs[neigh];
+      char *gw_ip = get_str_from_addr(table->neighbors[neigh]);
 
       std::string cost_str =
-          (neigh->cost >= INFINITY_COST) ? "INF" : std::to_string(neigh->cost);
+          (cost >= INFINITY_COST) ? "INF" : std::to_string(cost);
 
       // Mark if this is the best route
-      std::string best_marker = (dest->best == neigh) ? " *" : "";
+      std::string best_marker =
+          (dest->best_mask & (1ULL << neigh)) ? " *" : "";
 
       // clang-format off
       std::cout << std::setw(22) << std::left << subnet_str
@@ -357,7 +1213,7 @@ void print_routing_table(dv_table_t *table, pthread_mutex_t *cout_mutex) {
       // clang-format on
 
       free(gw_ip);
-      neigh = neigh->next;
+      known &= known - 1;
     }
 
     free(subnet_str);
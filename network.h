@@ -9,6 +9,8 @@
 #include <net/if.h>
 #include <pthread.h>
 
+#include "pool.h"
+
 #define INFINITY_COST 16
 
 typedef struct ip_addr_t {
@@ -23,44 +25,170 @@ typedef struct ip_subnet_t {
   uint8_t prefix_len;
 } ip_subnet_t;
 
-// linked list of advertised neighbor
-// routes for a specific destination
-typedef struct dv_neighbor_entry_t {
-  dv_neighbor_entry_t *next;
+// upper bound on interned neighbors, sizes the
+// per-destination cost row (one byte per neighbor)
+#define DV_MAX_NEIGHBORS 64
+#define DV_NO_NEIGHBOR 0xFF
 
-  ip_addr_t neighbor_addr;
-  uint32_t cost;
-} dv_neighbor_entry_t;
+// upper bound on equal cost next hops per destination
+#define DV_MAX_PATHS 8
 
-// linked list of advertised destinations
-// containing dv_neighbor_route list
+// linked list of advertised destinations,
+// costs[i] is the cost via neighbor i of the owning
+// table (INFINITY_COST if unknown) and bit i of known
+// is set once neighbor i has advertised the dest,
+// best_mask holds every neighbor tied at best_cost
+// (up to max_paths) and installed the set last
+// handed to the kernel
 typedef struct dv_dest_entry_t {
   dv_dest_entry_t *next;
+  // intrusive list of destinations whose selection changed
+  dv_dest_entry_t *dirty_next;
 
   ip_subnet_t dest;
-  dv_neighbor_entry_t *head;
-  dv_neighbor_entry_t *best;
-  dv_neighbor_entry_t *installed;
-  uint32_t best_cost;
+  uint8_t best;
+  uint8_t best_cost;
+  bool dirty;
+  // adopted from the kernel at startup and not yet relearned,
+  // kept out of the advertised vector
+  bool adopted;
+  uint64_t best_mask;
+  uint64_t installed;
+  uint64_t known;
+  uint8_t costs[DV_MAX_NEIGHBORS];
 } dv_dest_entry_t;
 
+// growable array of destination pointers
+typedef struct dv_dest_list_t {
+  dv_dest_entry_t **items;
+  size_t count;
+  size_t capacity;
+} dv_dest_list_t;
+
+struct lpm_trie_t;
+
+// open addressing slot keyed by the packed
+// address/prefix_len of a destination
+typedef struct dv_index_slot_t {
+  uint64_t key;
+  dv_dest_entry_t *dest;
+} dv_index_slot_t;
+
+// hash index over the destination list,
+// capacity is always a power of two
+typedef struct dv_dest_index_t {
+  dv_index_slot_t *slots;
+  size_t capacity;
+  size_t count;
+} dv_dest_index_t;
+
+// one advertised route as copied out of the table
+typedef struct dv_advert_t {
+  ip_subnet_t dest;
+  uint8_t cost;
+} dv_advert_t;
+
+// immutable copy of the advertised vector, shared by reference
+// count so it can be encoded and sent without table_mutex
+typedef struct dv_snapshot_t {
+  int refs;
+  uint64_t generation;
+  size_t count;
+  // allocated right behind the struct
+  dv_advert_t *routes;
+} dv_snapshot_t;
+
 // wrapper struct for head of ll
 typedef struct dv_table_t {
   dv_dest_entry_t *head;
+  dv_dest_index_t index;
+  slab_pool_t dest_pool;
+  ip_addr_t neighbors[DV_MAX_NEIGHBORS];
+  uint8_t neighbor_count;
+  // equal cost next hops kept per destination
+  uint8_t max_paths;
+  // reverse index: destinations each neighbor has advertised
+  dv_dest_list_t routes[DV_MAX_NEIGHBORS];
+  // neighbors whose routes are currently invalidated
+  // or that no longer carry any route
+  uint64_t down;
+  // destinations whose installed mask holds each neighbor, a slot
+  // is only handed to a new address once nothing refers to it
+  uint32_t installed_refs[DV_MAX_NEIGHBORS];
+  // longest prefix match view of the best routes
+  lpm_trie_t *fib;
+  // destinations changed since the last kernel sync
+  dv_dest_entry_t *dirty_head;
+  size_t dirty_count;
+  time_t last_change;
+  // moves on whenever the advertised vector changes
+  uint64_t generation;
+  // latest snapshot, replaced once generation moves past it
+  dv_snapshot_t *advertised;
   pthread_mutex_t *table_mutex;
   bool update_dv;
 } dv_table_t;
 
-typedef struct dv_parsed_entry_t {
-  dv_parsed_entry_t *next;
+// encoded DV body shared by every interface, the per-interface
+// "sender:DV:" header goes out in front of it, re-encoded only
+// for a snapshot of a newer generation
+typedef struct dv_encoding_t {
+  char *body;
+  size_t len;
+  size_t capacity;
+  uint64_t generation;
+  // binary only: header flags and the address sorted routes
+  uint8_t flags;
+  dv_advert_t *sorted;
+  size_t sorted_capacity;
+  // end offset of each datagram sized chunk of body
+  size_t *chunk_ends;
+  size_t chunk_count;
+  size_t chunk_capacity;
+} dv_encoding_t;
 
-  ip_subnet_t dest;
-  uint32_t cost;
-} dv_parsed_entry_t;
+// room for "255.255.255.255:DVC:4294967295:65535:65535:" and
+// the terminator
+#define DV_HEADER_MAX 48
+
+// largest DV datagram, below a 1500 byte MTU with room for
+// tunnel headers so chunks are never IP fragmented
+#define DV_CHUNK_SIZE 1400
+#define DV_CHUNK_BODY (DV_CHUNK_SIZE - DV_HEADER_MAX)
+#define DV_CHUNK_MAX UINT16_MAX
+
+// binary DV: magic, version, flags and a reserved byte, then the
+// sender address, followed by records of address, prefix length
+// and cost, with DV_BIN_DELTA the records are sorted and each
+// address is a LEB128 delta from the one before, with
+// DV_BIN_CHUNKED the generation, chunk index and chunk count
+// follow the header and deltas restart in every chunk
+#define DV_BIN_MAGIC 0xD7
+#define DV_BIN_VERSION 1
+#define DV_BIN_DELTA 0x01
+#define DV_BIN_CHUNKED 0x02
+#define DV_BIN_HEADER_LEN 8
+#define DV_BIN_CHUNK_LEN 8
+#define DV_BIN_RECORD_LEN 6
 
+// HELLO capability bits, carried in the byte after the SN
+#define HELLO_CAP_BINARY_DV 0x01
+
+// where a datagram sits in a chunked DV, a DV that fits one
+// datagram is chunk 0 of 1 and carries no chunk header
+typedef struct dv_chunk_t {
+  uint32_t generation;
+  uint16_t index;
+  uint16_t count;
+} dv_chunk_t;
+
+// a decoded DV, the parsers fill the caller's routes array
+// and never allocate
 typedef struct dv_parsed_msg_t {
   ip_addr_t sender;
-  dv_parsed_entry_t *head;
+  dv_chunk_t chunk;
+  dv_advert_t *routes;
+  size_t count;
 } dv_parsed_msg_t;
 
 typedef enum { MSG_UNKOWN, MSG_HELLO, MSG_DV } msg_type_t;
@@ -79,12 +207,76 @@ bool subnet_cmpr(ip_subnet_t subnet1, ip_subnet_t subnet2);
 
 int netmask_to_prefix(char *netmask_str);
 
-char *get_distance_vector(dv_table_t *table, ip_addr_t sender);
+uint64_t subnet_key(ip_subnet_t subnet);
+
+size_t subnet_key_hash(uint64_t key, size_t capacity);
+
+dv_dest_entry_t *dv_find_dest(dv_table_t *table, ip_subnet_t subnet);
+
+dv_dest_entry_t *dv_insert_dest(dv_table_t *table, ip_subnet_t subnet);
+
+uint8_t dv_find_neighbor(dv_table_t *table, ip_addr_t addr);
+
+uint8_t dv_intern_neighbor(dv_table_t *table, ip_addr_t addr);
+
+uint64_t dv_min_cost_mask(const uint8_t *costs, uint8_t count,
+                          uint8_t *min_cost);
+
+bool dv_set_cost(dv_table_t *table, dv_dest_entry_t *dest, uint8_t neighbor,
+                 uint8_t cost);
+
+bool dv_select_best(dv_table_t *table, dv_dest_entry_t *dest);
+
+void dv_dest_list_push(dv_dest_list_t *list, dv_dest_entry_t *dest);
+
+void dv_dest_list_free(dv_dest_list_t *list);
+
+size_t dv_invalidate_neighbor(dv_table_t *table, ip_addr_t addr);
+
+void dv_set_installed(dv_table_t *table, dv_dest_entry_t *dest,
+                      uint64_t mask);
+
+bool dv_invalidate_connected(dv_table_t *table, ip_subnet_t subnet);
+
+void dv_mark_dirty(dv_table_t *table, dv_dest_entry_t *dest);
+
+dv_dest_entry_t *dv_take_dirty(dv_table_t *table);
+
+bool dv_lookup(dv_table_t *table, ip_addr_t addr, ip_addr_t *next_hop);
+
+size_t dv_lookup_batch(dv_table_t *table, const ip_addr_t *addrs,
+                       size_t count, ip_addr_t *next_hops, bool *found);
+
+void dv_encoding_init(dv_encoding_t *enc);
+
+void dv_encoding_free(dv_encoding_t *enc);
+
+dv_snapshot_t *dv_snapshot_take(dv_table_t *table);
+
+void dv_snapshot_release(dv_snapshot_t *snap);
+
+bool dv_encode(const dv_snapshot_t *snap, dv_encoding_t *enc);
+
+size_t dv_encode_header(ip_addr_t sender, const dv_encoding_t *enc,
+                        size_t chunk, char *buf);
+
+bool dv_encode_binary(const dv_snapshot_t *snap, dv_encoding_t *enc);
+
+size_t dv_encode_binary_header(ip_addr_t sender, const dv_encoding_t *enc,
+                               size_t chunk, char *buf);
+
+const char *dv_encoding_chunk(const dv_encoding_t *enc, size_t chunk,
+                              size_t *len);
+
+bool dv_is_binary(const char *msg, size_t len);
+
+bool dv_read_chunk(const char *msg, size_t len, dv_chunk_t *chunk);
 
-dv_parsed_msg_t *parse_distance_vector(char *dv_str,
-                                       pthread_mutex_t *cout_mutex);
+bool parse_distance_vector_binary(const char *msg, size_t len,
+                                  dv_parsed_msg_t *out, size_t max_routes);
 
-void free_parsed_msg(dv_parsed_msg_t *msg);
+bool parse_distance_vector(const char *msg, size_t len, dv_parsed_msg_t *out,
+                           size_t max_routes);
 
 msg_type_t get_msg_type(char *msg);
 
@@ -0,0 +1,93 @@
+#include <cstdlib>
+
+#include "pool.h"
+
+#define POOL_ALIGN 16
+
+static size_t align_up(size_t size) {
+  return (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+// slab header, objects follow at the next aligned offset
+typedef struct slab_header_t {
+  slab_header_t *next;
+} slab_header_t;
+
+void slab_pool_init(slab_pool_t *pool, size_t obj_size, size_t objs_per_slab) {
+  // every object must be able to hold the free list link
+  pool->obj_size = align_up(obj_size < sizeof(void *) ? sizeof(void *)
+                                                      : obj_size);
+  pool->objs_per_slab = objs_per_slab ? objs_per_slab : 1;
+  pool->free_list = NULL;
+  pool->remote_free = NULL;
+  pool->slabs = NULL;
+  pool->heap_allocs = 0;
+  pool->allocs = 0;
+}
+
+void slab_pool_destroy(slab_pool_t *pool) {
+  slab_header_t *slab = (slab_header_t *)pool->slabs;
+  while (slab != NULL) {
+    slab_header_t *next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  pool->free_list = NULL;
+  pool->remote_free = NULL;
+  pool->slabs = NULL;
+}
+
+static bool slab_pool_grow(slab_pool_t *pool) {
+  size_t header = align_up(sizeof(slab_header_t));
+  char *mem = (char *)malloc(header + pool->obj_size * pool->objs_per_slab);
+  if (!mem) {
+    return false;
+  }
+  pool->heap_allocs++;
+
+  slab_header_t *slab = (slab_header_t *)mem;
+  slab->next = (slab_header_t *)pool->slabs;
+  pool->slabs = slab;
+
+  for (size_t i = 0; i < pool->objs_per_slab; i++) {
+    void **obj = (void **)(mem + header + i * pool->obj_size);
+    *obj = pool->free_list;
+    pool->free_list = obj;
+  }
+  return true;
+}
+
+void *slab_alloc(slab_pool_t *pool) {
+  if (pool->free_list == NULL) {
+    // take everything other threads have handed back at once
+    pool->free_list =
+        __atomic_exchange_n(&pool->remote_free, NULL, __ATOMIC_ACQUIRE);
+  }
+  if (pool->free_list == NULL && !slab_pool_grow(pool)) {
+    return NULL;
+  }
+
+  void **obj = (void **)pool->free_list;
+  pool->free_list = *obj;
+  pool->allocs++;
+  return obj;
+}
+
+void slab_free(slab_pool_t *pool, void *obj) {
+  if (!obj) {
+    return;
+  }
+  *(void **)obj = pool->free_list;
+  pool->free_list = obj;
+}
+
+void slab_free_remote(slab_pool_t *pool, void *obj) {
+  if (!obj) {
+    return;
+  }
+  void *head = __atomic_load_n(&pool->remote_free, __ATOMIC_RELAXED);
+  do {
+    *(void **)obj = head;
+  } while (!__atomic_compare_exchange_n(&pool->remote_free, &head, obj, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
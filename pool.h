@@ -0,0 +1,33 @@
+#ifndef POOL_H_INCLUDED
+#define POOL_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+// fixed size object pool carved out of malloc'd slabs,
+// alloc and slab_free belong to the owning thread while
+// any other thread returns objects with slab_free_remote
+typedef struct slab_pool_t {
+  size_t obj_size;
+  size_t objs_per_slab;
+
+  void *free_list;
+  void *remote_free;
+  void *slabs;
+
+  // heap_allocs counts slab mallocs, allocs counts objects
+  size_t heap_allocs;
+  size_t allocs;
+} slab_pool_t;
+
+void slab_pool_init(slab_pool_t *pool, size_t obj_size, size_t objs_per_slab);
+
+void slab_pool_destroy(slab_pool_t *pool);
+
+void *slab_alloc(slab_pool_t *pool);
+
+void slab_free(slab_pool_t *pool, void *obj);
+
+void slab_free_remote(slab_pool_t *pool, void *obj);
+
+#endif
@@ -1,174 +1,242 @@
 #include "processor.h"
+#include "lpm.h"
+#include "log.h"
 #include "network.h"
 #include "router.h"
+#include <cerrno>
+#include <cstdlib>
 #include <pthread.h>
+#include <time.h>
+
+// applies one queued message and hands its slot back to queue,
+// parsed routes land in the reused msg->routes array
+static void process_message(processor_data_t *data, msg_queue_t *queue,
+                            msg_queue_entry_t *msg_entry,
+                            dv_parsed_msg_t *msg) {
+  if (msg_entry->type == MSG_DV) {
+    bool parsed =
+        dv_is_binary(msg_entry->msg_str, msg_entry->len)
+            ? parse_distance_vector_binary(msg_entry->msg_str, msg_entry->len,
+                                           msg, PARSE_ROUTES_MAX)
+            : parse_distance_vector(msg_entry->msg_str, msg_entry->len, msg,
+                                    PARSE_ROUTES_MAX);
+    if (parsed) {
+      // chunks are applied alone, a route missing from one chunk is
+      // carried by another and is never taken as withdrawn
+      if (msg->chunk.count > 1) {
+        LOG_DEBUG("DV chunk %u of %u, generation %u", msg->chunk.index,
+                  msg->chunk.count, msg->chunk.generation);
+      }
+      process_distance_vector(msg, data->table);
+    } else {
+      LOG_ERROR("Could not parse message");
+    }
+    msg_slot_release(queue->slots, msg_entry);
+    return;
+  }
+
+  msg_slot_release(queue->slots, msg_entry);
+
+  LOG_WARN("Processing msg of type MSG_UNKNOWN");
+}
+
+static int64_t elapsed_us(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000 +
+         (now.tv_nsec - start->tv_nsec) / 1000;
+}
 
 void *processor_main(void *arg) {
   processor_data_t *data = (processor_data_t *)arg;
+  const router_config_t *config = data->config;
+
+  // parsed routes of the current message, reused for every DV
+  dv_parsed_msg_t msg;
+  msg.routes = (dv_advert_t *)malloc(PARSE_ROUTES_MAX * sizeof(*msg.routes));
+  if (!msg.routes) {
+    LOG_ERROR("could not allocate parse buffer");
+    return NULL;
+  }
+  uint16_t next_queue = 0;
 
   while (true) {
     // Check message queue
-    pthread_mutex_lock(data->msg_queue->queue_mutex);
-    while (data->msg_queue->queue_len == 0) {
-      pthread_cond_wait(data->msg_queue->queue_cond,
-                        data->msg_queue->queue_mutex);
-    }
-
-    msg_queue_entry_t *msg_entry = get_msg_queue_head(data->msg_queue);
-    pthread_mutex_unlock(data->msg_queue->queue_mutex);
+    msg_queue_t *queue;
+    msg_queue_entry_t *msg_entry = get_msg_queue_head(
+        data->msg_queues, data->queue_count, &next_queue, &queue);
 
     if (msg_entry == NULL) {
       continue;
     }
 
-    msg_type_t type = get_msg_type(msg_entry->msg_str);
-
-    if (type == MSG_HELLO) {
-      pthread_mutex_lock(data->cout_mutex);
-      // std::cout << "Processing msg of type MSG_HELLO" << std::endl;
-      pthread_mutex_unlock(data->cout_mutex);
-      process_hello(msg_entry->msg_str, msg_entry->int_name, data->hello_table,
-                    data->cout_mutex);
-      continue;
+    // apply whatever is already queued, bounded in size and time,
+    // so the kernel sync and the table dump happen once per batch
+    struct timespec batch_start;
+    clock_gettime(CLOCK_MONOTONIC, &batch_start);
+    int64_t max_latency_us = (int64_t)config->batch_latency_ms * 1000;
+    int batch = 0;
+
+    while (msg_entry != NULL) {
+      process_message(data, queue, msg_entry, &msg);
+      batch++;
+      if (batch >= config->batch_size ||
+          elapsed_us(&batch_start) >= max_latency_us) {
+        break;
+      }
+      msg_entry = msg_queues_pop(data->msg_queues, data->queue_count,
+                                 &next_queue, &queue);
     }
 
-    if (type == MSG_DV) {
-      pthread_mutex_lock(data->cout_mutex);
-      // std::cout << "Processing msg of type MSG_DV: " << msg_entry->msg_str
-      //           << std::endl;
-      pthread_mutex_unlock(data->cout_mutex);
-      dv_parsed_msg_t *msg =
-          parse_distance_vector(msg_entry->msg_str, data->cout_mutex);
-      if (msg) {
-        process_distance_vector(msg, data->table, data->cout_mutex);
-      } else {
-        pthread_mutex_lock(data->cout_mutex);
-        std::cout << "ERROR: Could not parse message" << std::endl;
-        pthread_mutex_unlock(data->cout_mutex);
-      }
+    commit_batch(data->table, data->install_queue);
+
+    LOG_DEBUG("Applied batch of %d messages in %ld us", batch,
+              (long)elapsed_us(&batch_start));
+
+    // full dumps are debugging aids, they block on cout_mutex
+    if (log_enabled(LOG_LEVEL_DEBUG)) {
       print_routing_table(data->table, data->cout_mutex);
-      continue;
+      print_alloc_stats(data);
+    }
+  }
+}
+
+void print_alloc_stats(processor_data_t *data) {
+  // totals over every receiver worker
+  size_t slots_free = 0, slot_count = 0, slot_drops = 0;
+  size_t queued = 0, high_water = 0, queue_drops = 0, coalesced = 0;
+  size_t received = 0, wakeups = 0;
+  double cpu_sec = 0;
+  for (uint16_t i = 0; i < data->queue_count; i++) {
+    msg_queue_t *queue = &data->msg_queues[i];
+    msg_slots_t *slots = queue->slots;
+    slots_free += spsc_ring_count(&slots->free_ring);
+    slot_count += slots->count;
+    slot_drops += __atomic_load_n(&slots->drops, __ATOMIC_RELAXED);
+    queued += spsc_ring_count(&queue->ring);
+    size_t queue_high = __atomic_load_n(&queue->high_water, __ATOMIC_RELAXED);
+    if (queue_high > high_water) {
+      high_water = queue_high;
     }
+    queue_drops += __atomic_load_n(&queue->drops, __ATOMIC_RELAXED);
+    coalesced += __atomic_load_n(&queue->coalesced, __ATOMIC_RELAXED);
+    received += __atomic_load_n(&queue->received, __ATOMIC_RELAXED);
+    wakeups += __atomic_load_n(&queue->wakeups, __ATOMIC_RELAXED);
+    cpu_sec += msg_queue_cpu_sec(queue);
+  }
 
-    free(msg_entry->msg_str);
-    free(msg_entry);
+  pthread_mutex_lock(data->cout_mutex);
+  std::cout << "Msg slots: " << slots_free << " of " << slot_count
+            << " free, " << slot_drops << " dropped" << std::endl;
+  std::cout << "Msg queues: " << queued << " queued in " << data->queue_count
+            << ", high water " << high_water << ", " << queue_drops
+            << " dropped, " << coalesced << " DVs coalesced" << std::endl;
+  // compares the receive models, io_uring cpu time includes sending
+  std::cout << "Receive: " << received << " datagrams, " << wakeups
+            << " wakeups, "
+            << (received ? (double)wakeups / received : 0.0)
+            << " wakeups and "
+            << (received ? cpu_sec * 1e6 / received : 0.0)
+            << " us cpu per datagram" << std::endl;
+  std::cout << "Log records dropped: " << log_drops() << std::endl;
+  pthread_mutex_unlock(data->cout_mutex);
+}
 
-    pthread_mutex_lock(data->cout_mutex);
-    std::cout << "Processing msg of type MSG_UNKNOWN" << std::endl;
-    pthread_mutex_unlock(data->cout_mutex);
+// takes the next message round robin from *next on, each neighbor
+// is served by one receiver worker so its messages stay in order
+msg_queue_entry_t *msg_queues_pop(msg_queue_t *queues, uint16_t count,
+                                  uint16_t *next, msg_queue_t **from) {
+  for (uint16_t i = 0; i < count; i++) {
+    msg_queue_t *queue = &queues[*next];
+    *next = (*next + 1) % count;
+    msg_queue_entry_t *head = (msg_queue_entry_t *)spsc_ring_pop(&queue->ring);
+    if (head != NULL) {
+      *from = queue;
+      return head;
+    }
   }
+  return NULL;
 }
 
-msg_queue_entry_t *get_msg_queue_head(msg_queue_t *queue) {
-  msg_queue_entry_t *head = queue->head;
-  if (head->next != NULL) {
-    queue->head = head->next;
-    queue->queue_len--;
-  } else {
-    queue->head = NULL;
-    queue->tail = NULL;
-    queue->queue_len = 0;
+msg_queue_entry_t *get_msg_queue_head(msg_queue_t *queues, uint16_t count,
+                                      uint16_t *next, msg_queue_t **from) {
+  msg_wake_t *wake = queues[0].wake;
+
+  while (true) {
+    msg_queue_entry_t *head = msg_queues_pop(queues, count, next, from);
+    if (head != NULL) {
+      return head;
+    }
+
+    // announce the wait, then look again so a push that
+    // missed the flag is not left sitting in a ring
+    __atomic_store_n(&wake->consumer_idle, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    head = msg_queues_pop(queues, count, next, from);
+    if (head != NULL) {
+      __atomic_store_n(&wake->consumer_idle, 0, __ATOMIC_RELAXED);
+      return head;
+    }
+
+    uint64_t wakeups;
+    if (read(wake->fd, &wakeups, sizeof(wakeups)) < 0 &&
+        errno != EINTR) {
+      return NULL;
+    }
   }
-  return head;
 }
 
 void handle_dead_link(hello_table_t *hello_table, dv_table_t *routing_table) {
-  bool dv_updated = false;
+  // snapshot the dead links so the receiver's HELLO updates
+  // never wait behind the routing table lock, dead entries
+  // stay in the hello table so there can be more than
+  // DV_MAX_NEIGHBORS of them
+  ip_addr_t *dead = NULL;
+  size_t dead_count = 0;
+  size_t dead_capacity = 0;
 
   pthread_mutex_lock(hello_table->table_mutex);
-  pthread_mutex_lock(routing_table->table_mutex);
-
   hello_entry_t *current_entry = hello_table->head;
-
   while (current_entry != NULL) {
     if (!current_entry->alive) {
-
-      ip_subnet_t link_subnet;
-      link_subnet.addr = current_entry->ip;
-      link_subnet.prefix_len = 24;
-      link_subnet.addr.f4 = 0;
-
-      dv_dest_entry_t *dest = routing_table->head;
-      while (dest != NULL) {
-        if (subnet_cmpr(dest->dest, link_subnet)) {
-          dv_neighbor_entry_t *route = dest->head;
-          bool recalc_needed = false;
-          while (route != NULL) {
-            if (addr_cmpr(route->neighbor_addr, (ip_addr_t){0, 0, 0, 0}) ||
-                addr_cmpr(route->neighbor_addr, current_entry->ip)) {
-              route->cost = INFINITY_COST;
-              recalc_needed = true;
-            }
-            route = route->next;
-          }
-          if (recalc_needed) {
-            dv_neighbor_entry_t *scan = dest->head;
-            uint32_t min_cost = INFINITY_COST;
-            dv_neighbor_entry_t *best = NULL;
-
-            while (scan != NULL) {
-              if (scan->cost < min_cost) {
-                min_cost = scan->cost;
-                best = scan;
-              }
-              scan = scan->next;
-            }
-            if (dest->best != best || dest->best_cost != min_cost) {
-              dest->best_cost = min_cost;
-              dest->best = best;
-              dv_updated = true;
-            }
-          }
-          dest = dest->next;
-          continue;
-        }
-
-        dv_neighbor_entry_t *route = dest->head;
-        bool recalc_needed = false;
-        while (route != NULL) {
-          if (addr_cmpr(route->neighbor_addr, current_entry->ip)) {
-            route->cost = INFINITY_COST;
-            recalc_needed = true;
-          }
-          route = route->next;
-        }
-
-        if (recalc_needed) {
-          dv_neighbor_entry_t *scan = dest->head;
-          uint32_t min_cost = INFINITY_COST;
-          dv_neighbor_entry_t *best = NULL;
-
-          while (scan != NULL) {
-            if (scan->cost < min_cost) {
-              min_cost = scan->cost;
-              best = scan;
-            }
-            scan = scan->next;
-          }
-          if (dest->best != best || dest->best_cost != min_cost) {
-            dest->best_cost = min_cost;
-            dest->best = best;
-            dv_updated = true;
-          }
+      if (dead_count == dead_capacity) {
+        size_t capacity =
+            dead_capacity ? dead_capacity * 2 : DV_MAX_NEIGHBORS;
+        ip_addr_t *grown =
+            (ip_addr_t *)realloc(dead, capacity * sizeof(*dead));
+        // out of memory, the rest go on the next check
+        if (!grown) {
+          break;
         }
-
-        dest = dest->next;
+        dead = grown;
+        dead_capacity = capacity;
       }
+      dead[dead_count++] = current_entry->ip;
     }
     current_entry = current_entry->next;
   }
+  pthread_mutex_unlock(hello_table->table_mutex);
+
+  pthread_mutex_lock(routing_table->table_mutex);
+
+  for (size_t i = 0; i < dead_count; i++) {
+    ip_subnet_t link_subnet;
+    link_subnet.addr = dead[i];
+    link_subnet.prefix_len = 24;
+    link_subnet.addr.f4 = 0;
 
-  if (dv_updated) {
-    dv_update(routing_table);
+    // the connected route to the dead link goes too,
+    // changed destinations are left on the dirty list
+    dv_invalidate_connected(routing_table, link_subnet);
+    dv_invalidate_neighbor(routing_table, dead[i]);
   }
 
-  pthread_mutex_unlock(hello_table->table_mutex);
   pthread_mutex_unlock(routing_table->table_mutex);
+  free(dead);
 }
 
 void process_topology_change(hello_table_t *hello_table,
                              dv_table_t *routing_table) {
-  bool dv_updated = false;
 
   pthread_mutex_lock(hello_table->table_mutex);
   pthread_mutex_lock(routing_table->table_mutex);
@@ -176,80 +244,37 @@ void process_topology_change(hello_table_t *hello_table,
   hello_entry_t *current_entry = hello_table->head;
 
   while (current_entry != NULL) {
+    // dead links are withdrawn by handle_dead_link, interning
+    // them again would keep their slots in use
+    if (!current_entry->alive) {
+      current_entry = current_entry->next;
+      continue;
+    }
+
     ip_subnet_t link_subnet;
     link_subnet.addr = current_entry->ip;
     link_subnet.prefix_len = 24;
     link_subnet.addr.f4 = 0;
 
-    dv_dest_entry_t *dest = routing_table->head;
-    while (dest != NULL) {
-      if (subnet_cmpr(dest->dest, link_subnet)) {
-        break;
-      }
-      dest = dest->next;
-    }
-
-    if (dest == NULL) {
-      dest = (dv_dest_entry_t *)malloc(sizeof(*dest));
-      dest->dest = link_subnet;
-      dest->head = NULL;
-      dest->best = NULL;
-      dest->installed = NULL;
-      dest->best_cost = INFINITY_COST;
-      dest->next = routing_table->head;
-      routing_table->head = dest;
-    }
-
-    dv_neighbor_entry_t *route = dest->head;
-    while (route != NULL) {
-      if (addr_cmpr(route->neighbor_addr, current_entry->ip)) {
-        break;
-      }
-      route = route->next;
-    }
-
-    if (route == NULL) {
-      route = (dv_neighbor_entry_t *)malloc(sizeof(*route));
-      route->neighbor_addr = current_entry->ip;
-      route->next = dest->head;
-      dest->head = route;
+    uint8_t neighbor = dv_intern_neighbor(routing_table, current_entry->ip);
+    dv_dest_entry_t *dest = dv_insert_dest(routing_table, link_subnet);
+    if (neighbor == DV_NO_NEIGHBOR || dest == NULL) {
+      current_entry = current_entry->next;
+      continue;
     }
 
-    uint32_t new_cost = current_entry->alive ? 1 : INFINITY_COST;
-
-    if (route->cost != new_cost) {
-      route->cost = new_cost;
+    dv_set_cost(routing_table, dest, neighbor, 1);
 
-      dv_neighbor_entry_t *scan = dest->head;
-      uint32_t min_cost = INFINITY_COST;
-      dv_neighbor_entry_t *best = NULL;
-
-      while (scan != NULL) {
-        if (scan->cost < min_cost) {
-          min_cost = scan->cost;
-          best = scan;
-        }
-        scan = scan->next;
-      }
-      if (dest->best != best || dest->best_cost != min_cost) {
-        dest->best_cost = min_cost;
-        dest->best = best;
-        dv_updated = true;
-      }
-    }
     current_entry = current_entry->next;
   }
 
-  if (dv_updated) {
-    dv_update(routing_table);
-  }
-
   pthread_mutex_unlock(hello_table->table_mutex);
   pthread_mutex_unlock(routing_table->table_mutex);
 }
 
-void process_hello(char *msg, char *int_name, hello_table_t *hello_table,
-                   pthread_mutex_t *cout_mutex) {
+void process_hello(char *msg, size_t len, char *int_name,
+                   hello_table_t *hello_table,
+                   const struct timespec *received_at) {
   char *first_colon = strchr(msg, ':');
   if (!first_colon) {
     return;
@@ -264,13 +289,20 @@ void process_hello(char *msg, char *int_name, hello_table_t *hello_table,
     return;
   }
 
+  // "HELLO:", the SN, then capabilities if the sender knows any
+  size_t sn_offset = hello_ptr + 6 - msg;
+  if (len < sn_offset + sizeof(uint16_t)) {
+    return;
+  }
   uint16_t sn_net;
   memcpy(&sn_net, hello_ptr + 6, sizeof(sn_net));
   uint16_t sn = ntohs(sn_net);
+  uint8_t caps = 0;
+  if (len > sn_offset + sizeof(uint16_t)) {
+    caps = (uint8_t)msg[sn_offset + sizeof(uint16_t)];
+  }
 
-  pthread_mutex_lock(cout_mutex);
-  std::cout << "SN: " << sn << std::endl;
-  pthread_mutex_unlock(cout_mutex);
+  LOG_DEBUG("SN: %u", sn);
 
   pthread_mutex_lock(hello_table->table_mutex);
 
@@ -280,6 +312,7 @@ void process_hello(char *msg, char *int_name, hello_table_t *hello_table,
   while (current_entry != NULL) {
     if (addr_cmpr(current_entry->ip, sender_ip)) {
       match_found = true;
+      current_entry->caps = caps;
       if (current_entry->last_sn < sn) {
         current_entry->last_sn = sn;
         current_entry->last_seen = time(NULL);
@@ -292,10 +325,18 @@ void process_hello(char *msg, char *int_name, hello_table_t *hello_table,
 
   if (!match_found) {
     hello_entry_t *new_entry = (hello_entry_t *)malloc(sizeof(*new_entry));
+    if (!new_entry) {
+      pthread_mutex_unlock(hello_table->table_mutex);
+      LOG_ERROR("Out of memory for neighbor %u.%u.%u.%u", sender_ip.f1,
+                sender_ip.f2, sender_ip.f3, sender_ip.f4);
+      return;
+    }
+    hello_table->heap_allocs++;
     new_entry->ip = sender_ip;
     new_entry->last_sn = sn;
     new_entry->last_seen = time(NULL);
     new_entry->alive = true;
+    new_entry->caps = caps;
     strcpy(new_entry->int_name, int_name);
 
     new_entry->next = hello_table->head;
@@ -303,130 +344,60 @@ void process_hello(char *msg, char *int_name, hello_table_t *hello_table,
 
     hello_table->neighbor_added = true;
 
-    pthread_mutex_lock(cout_mutex);
-    char *sender_ip_str = get_str_from_addr(sender_ip);
-    std::cout << "New Neighbor Found @ " << sender_ip_str << "!" << std::endl;
-    free(sender_ip_str);
-    pthread_mutex_unlock(cout_mutex);
+    LOG_INFO("New Neighbor Found @ %u.%u.%u.%u!", sender_ip.f1, sender_ip.f2,
+             sender_ip.f3, sender_ip.f4);
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t latency = (now.tv_sec - received_at->tv_sec) * 1000000 +
+                    (now.tv_nsec - received_at->tv_nsec) / 1000;
+  if (latency < 0) {
+    latency = 0;
+  }
+  hello_table->hello_count++;
+  hello_table->hello_latency_total += latency;
+  if ((uint64_t)latency > hello_table->hello_latency_max) {
+    hello_table->hello_latency_max = latency;
   }
 
   pthread_mutex_unlock(hello_table->table_mutex);
 }
 
-void process_distance_vector(dv_parsed_msg_t *msg, dv_table_t *table,
-                             pthread_mutex_t *cout_mutex) {
-  bool dv_updated = false;
-
+void process_distance_vector(dv_parsed_msg_t *msg, dv_table_t *table) {
   pthread_mutex_lock(table->table_mutex);
 
-  dv_parsed_entry_t *current_route = msg->head;
-
-  if (current_route == NULL) {
-    pthread_mutex_lock(cout_mutex);
-    std::cout << "ERROR: parsed message malformed" << std::endl;
-    pthread_mutex_unlock(cout_mutex);
+  uint8_t neighbor = dv_intern_neighbor(table, msg->sender);
+  if (neighbor == DV_NO_NEIGHBOR) {
+    LOG_ERROR("neighbor table full");
+    pthread_mutex_unlock(table->table_mutex);
+    return;
   }
 
-  while (current_route != NULL) {
-    pthread_mutex_lock(cout_mutex);
-    char *crd = get_str_from_subnet(current_route->dest);
-    // std::cout << "~~ Parsing route " << crd << std::endl;
-    free(crd);
-    pthread_mutex_unlock(cout_mutex);
-
-    dv_dest_entry_t *current_entry = table->head;
-    dv_dest_entry_t *dest = NULL;
-
-    // search for dest in current routing table
-    while (current_entry != NULL) {
-      if (subnet_cmpr(current_route->dest, current_entry->dest)) {
-        dest = current_entry;
-        break;
-      }
-      current_entry = current_entry->next;
-    }
-
-    // create new entry for dest if needed
+  for (size_t i = 0; i < msg->count; i++) {
+    // find dest in current routing table, creating it if needed
+    dv_dest_entry_t *dest = dv_insert_dest(table, msg->routes[i].dest);
     if (dest == NULL) {
-      dest = (dv_dest_entry_t *)malloc(sizeof(*dest));
-      dest->dest = current_route->dest;
-      dest->head = NULL;
-      dest->best = NULL;
-      dest->installed = NULL;
-      dest->best_cost = INFINITY_COST;
-      dest->next = table->head;
-      table->head = dest;
-    }
-
-    dv_neighbor_entry_t *current_neighbor = dest->head;
-    dv_neighbor_entry_t *neighbor = NULL;
-
-    // search for neighbor in dest entry
-    while (current_neighbor != NULL) {
-      if (addr_cmpr(msg->sender, current_neighbor->neighbor_addr)) {
-        neighbor = current_neighbor;
-        break;
-      }
-      current_neighbor = current_neighbor->next;
-    }
-
-    // create new entry for neighbor if needed
-    if (neighbor == NULL) {
-      neighbor = (dv_neighbor_entry_t *)malloc(sizeof(*neighbor));
-      neighbor->neighbor_addr = msg->sender;
-      neighbor->cost = INFINITY_COST;
-      neighbor->next = dest->head;
-      dest->head = neighbor;
+      break;
     }
 
-    pthread_mutex_lock(cout_mutex);
-    char *nba = get_str_from_addr(neighbor->neighbor_addr);
-    // std::cout << "~~ Parsing neighbor " << nba
-    //           << " with current cost: " << neighbor->cost
-    //           << " and new cost: " << current_route->cost + 1 << std::endl;
-    free(nba);
-    pthread_mutex_unlock(cout_mutex);
-
-    uint32_t new_cost = current_route->cost + 1;
+    uint32_t new_cost = msg->routes[i].cost + 1;
     if (new_cost > INFINITY_COST) {
       new_cost = INFINITY_COST;
     }
 
-    bool is_best = (dest->best == neighbor);
-    uint32_t old_cost = neighbor->cost;
-    neighbor->cost = new_cost;
-
-    if (new_cost < dest->best_cost) {
-      // if new cost is better than old best cost
-      dest->best_cost = new_cost;
-      dest->best = neighbor;
-      dv_updated = true;
-    } else if (is_best && new_cost > old_cost) {
-      // if new cost is worse and this was previously the best route
-      uint32_t min_cost = INFINITY_COST;
-      dv_neighbor_entry_t *best_route = NULL;
-      dv_neighbor_entry_t *current_cand = dest->head;
-
-      while (current_cand != NULL) {
-        if (current_cand->cost < min_cost) {
-          best_route = current_cand;
-          min_cost = current_cand->cost;
-        }
-        current_cand = current_cand->next;
-      }
-
-      dest->best = best_route;
-      dest->best_cost = min_cost;
-      dv_updated = true;
-    }
-    current_route = current_route->next;
+    dv_set_cost(table, dest, neighbor, (uint8_t)new_cost);
   }
-  if (dv_updated) {
-    pthread_mutex_lock(cout_mutex);
-    std::cout << "DV Updated! installing new routes" << std::endl;
-    pthread_mutex_unlock(cout_mutex);
-    sync_kernel_routes(table, cout_mutex);
-    dv_update(table);
+  // changes wait on the dirty list for commit_batch
+  pthread_mutex_unlock(table->table_mutex);
+}
+
+void commit_batch(dv_table_t *table, install_queue_t *install_queue) {
+  pthread_mutex_lock(table->table_mutex);
+  // the sync flags the DV for sending once for the whole batch
+  if (table->dirty_head != NULL) {
+    LOG_DEBUG("DV Updated! installing new routes");
+    sync_kernel_routes(table, install_queue);
   }
   pthread_mutex_unlock(table->table_mutex);
 }
@@ -1,29 +1,48 @@
 #ifndef PROCESSOR_H_INCLUDED
 #define PROCESSOR_H_INCLUDED
 
+#include "installer.h"
 #include "network.h"
+#include "pool.h"
+#include "receiver.h"
 #include "router.h"
 
+// routes a single datagram can carry, the shortest binary
+// record is 3 bytes and a text entry is longer still
+#define PARSE_ROUTES_MAX (REC_BUFF_SIZE / 3)
+
 typedef struct processor_data_t {
-  msg_queue_t *msg_queue;
+  // one queue per receiver worker
+  msg_queue_t *msg_queues;
+  uint16_t queue_count;
   hello_table_t *hello_table;
   dv_table_t *table;
+  install_queue_t *install_queue;
+  const router_config_t *config;
   pthread_mutex_t *cout_mutex;
 } processor_data_t;
 
-msg_queue_entry_t *get_msg_queue_head(msg_queue_t *queue);
+msg_queue_entry_t *msg_queues_pop(msg_queue_t *queues, uint16_t count,
+                                  uint16_t *next, msg_queue_t **from);
+
+msg_queue_entry_t *get_msg_queue_head(msg_queue_t *queues, uint16_t count,
+                                      uint16_t *next, msg_queue_t **from);
 
 void process_topology_change(hello_table_t *hello_table,
                              dv_table_t *routing_table);
 
-void process_hello(char *msg, char *int_name, hello_table_t *hello_table,
-                   pthread_mutex_t *cout_mutex);
+void process_hello(char *msg, size_t len, char *int_name,
+                   hello_table_t *hello_table,
+                   const struct timespec *received_at);
 
-void process_distance_vector(dv_parsed_msg_t *msg, dv_table_t *table,
-                             pthread_mutex_t *cout_mutex);
+void process_distance_vector(dv_parsed_msg_t *msg, dv_table_t *table);
+
+void commit_batch(dv_table_t *table, install_queue_t *install_queue);
 
 void handle_dead_link(hello_table_t *hello_table, dv_table_t *routing_table);
 
+void print_alloc_stats(processor_data_t *data);
+
 void *processor_main(void *arg);
 
 #endif
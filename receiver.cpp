@@ -1,102 +1,297 @@
+#include <cerrno>
 #include <cstdint>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <time.h>
 
 #include "receiver.h"
 #include "router.h"
+#include "log.h"
 #include "network.h"
+#include "processor.h"
 
-void *receiver_main(void *arg) {
-  receiver_data_t *data = (receiver_data_t *)arg;
-  fd_set readfds;
-  int max_fd = 0;
+// interface named by IP_PKTINFO, NULL if missing or not ours
+static router_socket_t *receive_interface(socket_list_t *sockets,
+                                          struct msghdr *hdr) {
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+    if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+      struct in_pktinfo pktinfo;
+      memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+      return socket_for_ifindex(sockets, pktinfo.ipi_ifindex);
+    }
+  }
+  return NULL;
+}
+
+// checks a received slot, false for our own broadcasts
+static bool accept_datagram(receiver_data_t *data, router_socket_t *s,
+                            msg_queue_entry_t *entry, unsigned int n,
+                            struct msghdr *hdr) {
+  if (n == 0) {
+    return false;
+  }
+  if (data->sockets.shared) {
+    s = receive_interface(&data->sockets, hdr);
+    if (s == NULL) {
+      return false;
+    }
+  }
+  struct sockaddr_in *sender_addr = (struct sockaddr_in *)hdr->msg_name;
+  entry->msg_str[n] = '\0';
+  entry->len = n;
+  char sender[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &sender_addr->sin_addr, sender, INET_ADDRSTRLEN);
+
+  ip_addr_t sender_ip = get_addr_from_str(sender);
 
-  char *buffer = (char *)malloc(REC_BUFF_SIZE);
-  if (!buffer) {
+  for (uint16_t i = 0; i < data->local_ips.count; i++) {
+    ip_addr_t local_ip = data->local_ips.ips[i];
+    // ignore messages from self
+    if (addr_cmpr(sender_ip, local_ip)) {
+      return false;
+    }
+  }
+
+  memcpy(entry->int_name, s->name, 16);
+  entry->sender = sender_ip;
+  entry->type = get_msg_type(entry->msg_str);
+  entry->chunk = 0;
+  dv_chunk_t chunk;
+  if (entry->type == MSG_DV && dv_read_chunk(entry->msg_str, n, &chunk)) {
+    entry->chunk = chunk.index;
+  }
+
+  // logged before queueing, the processor may reuse the slot after
+  if (dv_is_binary(entry->msg_str, n)) {
+    LOG_DEBUG("Received update from %s on %s: binary DV, %u bytes", sender,
+              s->name, n);
+  } else {
+    LOG_DEBUG("Received update from %s on %s: %s", sender, s->name,
+              entry->msg_str);
+  }
+  return true;
+}
+
+// kernel receive time of a datagram, now if it carried none
+static void receive_time(struct msghdr *hdr, struct timespec *received_at) {
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+      memcpy(received_at, CMSG_DATA(cmsg), sizeof(*received_at));
+      return;
+    }
+  }
+  clock_gettime(CLOCK_REALTIME, received_at);
+}
+
+static bool same_sender_dv(void *queued, void *ctx) {
+  msg_queue_entry_t *queued_entry = (msg_queue_entry_t *)queued;
+  msg_queue_entry_t *entry = (msg_queue_entry_t *)ctx;
+  return queued_entry->type == MSG_DV &&
+         queued_entry->chunk == entry->chunk &&
+         addr_cmpr(queued_entry->sender, entry->sender);
+}
+
+// the processor only waits on the eventfd after announcing itself idle
+static void wake_msg_consumer(msg_queue_t *queue) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_exchange_n(&queue->wake->consumer_idle, 0, __ATOMIC_SEQ_CST)) {
+    uint64_t one = 1;
+    if (write(queue->wake->fd, &one, sizeof(one)) < 0) {
+      return;
+    }
+  }
+}
+
+msg_queue_entry_t *msg_queue_push(msg_queue_t *queue,
+                                  msg_queue_entry_t *entry) {
+  // a DV chunk carries the same part of the sender's vector as an
+  // older one, so it takes the place of an unprocessed DV chunk
+  // from that sender with the same index instead of queueing
+  if (entry->type == MSG_DV) {
+    void *coalesced =
+        spsc_ring_replace(&queue->ring, same_sender_dv, entry, entry);
+    if (coalesced) {
+      __atomic_fetch_add(&queue->coalesced, 1, __ATOMIC_RELAXED);
+      return (msg_queue_entry_t *)coalesced;
+    }
+  }
+
+  if (spsc_ring_push(&queue->ring, entry)) {
+    size_t depth = spsc_ring_count(&queue->ring);
+    if (depth > queue->high_water) {
+      __atomic_store_n(&queue->high_water, depth, __ATOMIC_RELAXED);
+    }
+    wake_msg_consumer(queue);
     return NULL;
   }
 
-  struct sockaddr_in sender_addr;
-  socklen_t addr_len = sizeof(sender_addr);
+  __atomic_fetch_add(&queue->drops, 1, __ATOMIC_RELAXED);
+  return entry;
+}
+
+msg_queue_entry_t *receive_datagram(receiver_data_t *data, router_socket_t *s,
+                                    msg_queue_entry_t *entry, unsigned int n,
+                                    struct msghdr *hdr) {
+  // single writer, the stats reader only loads it
+  __atomic_store_n(&data->msg_queue->received, data->msg_queue->received + 1,
+                   __ATOMIC_RELAXED);
+  if (!accept_datagram(data, s, entry, n, hdr)) {
+    return entry;
+  }
+
+  // HELLOs keep neighbors alive, so they never wait behind DVs
+  if (entry->type == MSG_HELLO) {
+    struct timespec received_at;
+    receive_time(hdr, &received_at);
+    process_hello(entry->msg_str, entry->len, entry->int_name,
+                  data->hello_table, &received_at);
+    return entry;
+  }
+
+  // a dropped or coalesced message hands its slot back
+  return msg_queue_push(data->msg_queue, entry);
+}
+
+// reads a ready socket until the kernel has nothing left, slots that
+// end up unqueued stay reserved for the next batch
+static void drain_socket(receiver_data_t *data, router_socket_t *s,
+                         recv_batch_t *batch, char *scratch) {
+  msg_slots_t *slots = data->msg_queue->slots;
 
   while (true) {
-    FD_ZERO(&readfds);
-    for (uint16_t i = 0; i < data->sockets.count; i++) {
-      router_socket_t s = data->sockets.sockets[i];
-      FD_SET(s.fd, &readfds);
-      if (s.fd > max_fd) {
-        max_fd = s.fd;
+    while (batch->reserved < RECV_BATCH_SIZE) {
+      msg_queue_entry_t *entry = msg_slot_take(slots);
+      if (!entry) {
+        break;
       }
+      batch->slots[batch->reserved++] = entry;
     }
 
-    // select functionality based on
-    // https://www.man7.org/linux/man-pages/man2/select.2.html
-
-    int pending_sockets = select(max_fd + 1, &readfds, NULL, NULL, NULL);
-
-    if (pending_sockets > 0) {
-      for (uint16_t i = 0; i < data->sockets.count; i++) {
-        router_socket_t s = data->sockets.sockets[i];
-        if (FD_ISSET(s.fd, &readfds)) {
-          int n = recvfrom(s.fd, buffer, REC_BUFF_SIZE - 1, 0,
-                           (struct sockaddr *)&sender_addr, &addr_len);
-          if (n > 0) {
-            buffer[n] = '\0';
-            char sender[INET_ADDRSTRLEN];
-            inet_ntop(AF_INET, &sender_addr.sin_addr, sender, INET_ADDRSTRLEN);
-
-            ip_addr_t sender_ip = get_addr_from_str(sender);
-
-            bool is_local = false;
-
-            for (uint16_t i = 0; i < data->local_ips.count; i++) {
-              ip_addr_t local_ip = data->local_ips.ips[i];
-              if (addr_cmpr(sender_ip, local_ip)) {
-                is_local = true;
-                break;
-              }
-            }
-
-            // ignore messages from self
-            if (is_local) {
-              continue;
-            }
-
-            msg_queue_entry_t *new_node =
-                (msg_queue_entry_t *)malloc(sizeof(*new_node));
-            if (!new_node) {
-              continue;
-            }
-
-            new_node->msg_str = (char *)malloc(n + 1);
-            memcpy(new_node->msg_str, buffer, n);
-            new_node->msg_str[n] = '\0';
-            memcpy(new_node->int_name, s.name, 16);
-            new_node->next = NULL;
-
-            pthread_mutex_lock(data->msg_queue->queue_mutex);
-
-            if (data->msg_queue->head == NULL) {
-              data->msg_queue->head = new_node;
-            } else {
-              data->msg_queue->tail->next = new_node;
-            }
-            data->msg_queue->tail = new_node;
-            data->msg_queue->queue_len++;
-
-            pthread_mutex_unlock(data->msg_queue->queue_mutex);
-            pthread_cond_signal(data->msg_queue->queue_cond);
-
-            pthread_mutex_lock(data->cout_mutex);
-            std::cout << "Received update from " << sender << " on " << s.name
-                      << std::endl;
-            std::cout << "  : " << buffer << std::endl;
-            pthread_mutex_unlock(data->cout_mutex);
-          }
+    if (batch->reserved == 0) {
+      // every slot is queued, discard so the socket still drains
+      int n = recv(s->fd, scratch, REC_BUFF_SIZE, MSG_DONTWAIT);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
         }
+        return;
+      }
+      __atomic_fetch_add(&slots->drops, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    unsigned int requested = batch->reserved;
+    for (unsigned int i = 0; i < requested; i++) {
+      batch->iov[i].iov_base = batch->slots[i]->msg_str;
+      batch->iov[i].iov_len = REC_BUFF_SIZE - 1;
+      memset(&batch->hdrs[i], 0, sizeof(batch->hdrs[i]));
+      batch->hdrs[i].msg_hdr.msg_name = &batch->addrs[i];
+      batch->hdrs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+      batch->hdrs[i].msg_hdr.msg_iov = &batch->iov[i];
+      batch->hdrs[i].msg_hdr.msg_iovlen = 1;
+      batch->hdrs[i].msg_hdr.msg_control = batch->control[i];
+      batch->hdrs[i].msg_hdr.msg_controllen = sizeof(batch->control[i]);
+    }
+
+    int received = recvmmsg(s->fd, batch->hdrs, requested, MSG_DONTWAIT, NULL);
+    if (received < 0) {
+      if (errno == EINTR) {
+        continue;
       }
+      return;
+    }
+
+    unsigned int kept = 0;
+
+    for (unsigned int i = 0; i < requested; i++) {
+      msg_queue_entry_t *entry = batch->slots[i];
+      if ((int)i < received) {
+        entry = receive_datagram(data, s, entry, batch->hdrs[i].msg_len,
+                                 &batch->hdrs[i].msg_hdr);
+        if (entry == NULL) {
+          continue;
+        }
+      }
+      batch->slots[kept++] = entry;
+    }
+    batch->reserved = kept;
+
+    // a short batch means the socket is empty
+    if ((unsigned int)received < requested) {
+      return;
+    }
+  }
+}
+
+void *receiver_main(void *arg) {
+  receiver_data_t *data = (receiver_data_t *)arg;
+
+  if (data->cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(data->cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      LOG_WARN("could not pin receiver to cpu %d", data->cpu);
+    }
+  }
+
+  char *scratch = (char *)malloc(REC_BUFF_SIZE);
+  recv_batch_t *batch = (recv_batch_t *)malloc(sizeof(*batch));
+  if (!scratch || !batch) {
+    free(scratch);
+    free(batch);
+    return NULL;
+  }
+  batch->reserved = 0;
+
+  // epoll functionality based on
+  // https://www.man7.org/linux/man-pages/man7/epoll.7.html
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    LOG_ERROR("could not create epoll instance");
+    free(scratch);
+    free(batch);
+    return NULL;
+  }
+
+  // edge triggered, each event carries its socket
+  for (uint16_t i = 0; i < data->sockets.count; i++) {
+    router_socket_t *s = &data->sockets.sockets[i];
+    if (s->fd < 0) {
+      continue;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = s;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s->fd, &ev) < 0) {
+      LOG_ERROR("could not watch socket on %s", s->name);
+    }
+  }
+
+  struct epoll_event events[RECV_MAX_EVENTS];
+  msg_queue_set_receiver(data->msg_queue);
+
+  while (true) {
+    int ready = epoll_wait(epoll_fd, events, RECV_MAX_EVENTS, -1);
+    __atomic_store_n(&data->msg_queue->wakeups, data->msg_queue->wakeups + 1,
+                     __ATOMIC_RELAXED);
+    if (ready < 0) {
+      continue;
+    }
+
+    for (int i = 0; i < ready; i++) {
+      router_socket_t *s = (router_socket_t *)events[i].data.ptr;
+      drain_socket(data, s, batch, scratch);
     }
   }
 
-  free(buffer);
+  close(epoll_fd);
+  free(scratch);
+  free(batch);
 }
@@ -5,13 +5,49 @@
 
 #define REC_BUFF_SIZE 4096
 
+// ready sockets handled per epoll_wait
+#define RECV_MAX_EVENTS 64
+
+// datagrams read per recvmmsg call
+#define RECV_BATCH_SIZE 32
+
+// ancillary space for a receive timestamp and IP_PKTINFO
+#define RECV_CONTROL_LEN                                                       \
+  (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(struct in_pktinfo)))
+
+// slots held by the receiver between recvmmsg calls, with
+// the headers that point the kernel straight at their buffers
+typedef struct recv_batch_t {
+  msg_queue_entry_t *slots[RECV_BATCH_SIZE];
+  unsigned int reserved;
+
+  struct mmsghdr hdrs[RECV_BATCH_SIZE];
+  struct iovec iov[RECV_BATCH_SIZE];
+  struct sockaddr_in addrs[RECV_BATCH_SIZE];
+  char control[RECV_BATCH_SIZE][RECV_CONTROL_LEN];
+} recv_batch_t;
+
+// one receiver worker, it reads only its own sockets
 typedef struct receiver_data_t {
   local_ip_list_t local_ips;
   socket_list_t sockets;
   msg_queue_t *msg_queue;
-  pthread_mutex_t *cout_mutex;
+  hello_table_t *hello_table;
+  // core the worker is pinned to, -1 to leave it unpinned
+  int cpu;
 } receiver_data_t;
 
+// queues entry for the processor and returns the slot the receiver gets
+// back: NULL once queued, else a coalesced DV or entry itself if dropped
+msg_queue_entry_t *msg_queue_push(msg_queue_t *queue,
+                                  msg_queue_entry_t *entry);
+
+// handles one datagram read into entry, returns the slot the caller
+// keeps: NULL once queued, else entry or a coalesced DV to reuse
+msg_queue_entry_t *receive_datagram(receiver_data_t *data, router_socket_t *s,
+                                    msg_queue_entry_t *entry, unsigned int n,
+                                    struct msghdr *hdr);
+
 void *receiver_main(void *arg);
 
 #endif
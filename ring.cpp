@@ -0,0 +1,82 @@
+#include <cstdlib>
+
+#include "ring.h"
+
+bool spsc_ring_init(spsc_ring_t *ring, size_t capacity) {
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  ring->cells = (void **)calloc(size, sizeof(void *));
+  if (!ring->cells) {
+    return false;
+  }
+  ring->mask = size - 1;
+  ring->head = 0;
+  ring->tail = 0;
+  return true;
+}
+
+void spsc_ring_destroy(spsc_ring_t *ring) {
+  free(ring->cells);
+  ring->cells = NULL;
+  ring->mask = 0;
+}
+
+bool spsc_ring_push(spsc_ring_t *ring, void *item) {
+  size_t tail = ring->tail;
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if (tail - head > ring->mask) {
+    return false;
+  }
+
+  ring->cells[tail & ring->mask] = item;
+  // publish the cell before the new tail
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+void *spsc_ring_pop(spsc_ring_t *ring) {
+  size_t head = ring->head;
+  size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (head == tail) {
+    return NULL;
+  }
+
+  // emptying the cell makes a racing replace fail,
+  // the cell may be reused once head moves past it
+  void **cell = &ring->cells[head & ring->mask];
+  void *item = __atomic_exchange_n(cell, NULL, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return item;
+}
+
+// producer side: swaps item into the newest queued cell that match
+// accepts and returns the displaced item, NULL when nothing matched
+void *spsc_ring_replace(spsc_ring_t *ring, bool (*match)(void *, void *),
+                        void *ctx, void *item) {
+  size_t tail = ring->tail;
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  for (size_t pos = tail; pos != head; pos--) {
+    void **cell = &ring->cells[(pos - 1) & ring->mask];
+    void *queued = __atomic_load_n(cell, __ATOMIC_ACQUIRE);
+    if (queued == NULL || !match(queued, ctx)) {
+      continue;
+    }
+    // fails only if the consumer took the cell meanwhile
+    if (__atomic_compare_exchange_n(cell, &queued, item, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return queued;
+    }
+    return NULL;
+  }
+  return NULL;
+}
+
+size_t spsc_ring_count(spsc_ring_t *ring) {
+  size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  return tail - head;
+}
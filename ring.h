@@ -0,0 +1,37 @@
+#ifndef RING_H_INCLUDED
+#define RING_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#define RING_CACHE_LINE 64
+
+// bounded lock-free ring of pointers for exactly one producer
+// and one consumer thread, capacity is a power of two. the
+// producer may also swap an item that is still queued
+typedef struct spsc_ring_t {
+  void **cells;
+  size_t mask;
+
+  // advanced by the consumer only
+  size_t head;
+  char head_pad[RING_CACHE_LINE - sizeof(size_t)];
+  // advanced by the producer only
+  size_t tail;
+  char tail_pad[RING_CACHE_LINE - sizeof(size_t)];
+} spsc_ring_t;
+
+bool spsc_ring_init(spsc_ring_t *ring, size_t capacity);
+
+void spsc_ring_destroy(spsc_ring_t *ring);
+
+bool spsc_ring_push(spsc_ring_t *ring, void *item);
+
+void *spsc_ring_pop(spsc_ring_t *ring);
+
+void *spsc_ring_replace(spsc_ring_t *ring, bool (*match)(void *, void *),
+                        void *ctx, void *item);
+
+size_t spsc_ring_count(spsc_ring_t *ring);
+
+#endif
@@ -2,14 +2,40 @@
 #include <cstdlib>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include "installer.h"
+#include "log.h"
+#include "lpm.h"
+#include "netlink.h"
 #include "network.h"
 #include "processor.h"
 #include "receiver.h"
 #include "router.h"
 #include "sender.h"
+#include "uring.h"
+
+// interfaces dealt round robin to the receiver workers, a
+// neighbor is reached over one interface so one worker reads it
+static socket_list_t receiver_sockets(socket_list_t sockets, uint16_t worker,
+                                      uint16_t workers) {
+  if (workers == 1) {
+    return sockets;
+  }
+  socket_list_t share = sockets;
+  share.sockets =
+      (router_socket_t *)malloc(sockets.count * sizeof(*share.sockets));
+  if (!share.sockets) {
+    exit(EXIT_FAILURE);
+  }
+  share.count = 0;
+  for (uint16_t i = worker; i < sockets.count; i += workers) {
+    share.sockets[share.count++] = sockets.sockets[i];
+  }
+  return share;
+}
 
 void *router_main(void *arg) {
   router_data_t *data = (router_data_t *)arg;
@@ -22,12 +48,33 @@ void *router_main(void *arg) {
 
   interface_list_t interfaces = get_interfaces(data->cout_mutex);
   local_ip_list_t local_ips = get_local_ips(interfaces);
-  socket_list_t sockets = bind_sockets(interfaces, data->cout_mutex);
+  socket_list_t sockets =
+      data->config.shared_socket
+          ? bind_shared_socket(interfaces, data->cout_mutex)
+          : bind_sockets(interfaces, data->cout_mutex);
 
   pthread_mutex_t routing_table_mutex = PTHREAD_MUTEX_INITIALIZER;
   dv_table_t *routing_table = (dv_table_t *)malloc(sizeof(*routing_table));
   routing_table->head = NULL;
+  routing_table->index = (dv_dest_index_t){NULL, 0, 0};
+  routing_table->neighbor_count = 0;
+  routing_table->max_paths = data->config.max_paths;
+  memset(routing_table->routes, 0, sizeof(routing_table->routes));
+  routing_table->down = 0;
+  memset(routing_table->installed_refs, 0,
+         sizeof(routing_table->installed_refs));
+  routing_table->fib = lpm_create();
+  if (!routing_table->fib) {
+    exit(EXIT_FAILURE);
+  }
+  slab_pool_init(&routing_table->dest_pool, sizeof(dv_dest_entry_t),
+                 DEST_POOL_SLAB_COUNT);
   routing_table->table_mutex = &routing_table_mutex;
+  routing_table->dirty_head = NULL;
+  routing_table->dirty_count = 0;
+  routing_table->last_change = time(NULL);
+  routing_table->generation = 0;
+  routing_table->advertised = NULL;
   routing_table->update_dv = false;
 
   pthread_mutex_t hello_table_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -36,15 +83,42 @@ void *router_main(void *arg) {
   hello_table->table_mutex = &hello_table_mutex;
   hello_table->neighbor_added = false;
   hello_table->neighbor_dead = false;
+  hello_table->hello_count = 0;
+  hello_table->hello_latency_total = 0;
+  hello_table->hello_latency_max = 0;
+  hello_table->heap_allocs = 0;
+
+  // the shared socket and the io_uring loop are read by one
+  // thread, otherwise each worker needs at least one socket
+  uint16_t receivers = data->config.receivers;
+  if (sockets.shared || data->config.io_uring) {
+    receivers = 1;
+  }
+  if (receivers > sockets.count) {
+    receivers = sockets.count > 0 ? sockets.count : 1;
+  }
+  if (receivers < data->config.receivers) {
+    LOG_WARN("Using %u of %d receiver workers", receivers,
+             data->config.receivers);
+  }
 
-  pthread_mutex_t msg_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-  pthread_cond_t msg_queue_cond = PTHREAD_COND_INITIALIZER;
-  msg_queue_t *msg_queue = (msg_queue_t *)malloc(sizeof(*msg_queue));
-  msg_queue->head = NULL;
-  msg_queue->tail = NULL;
-  msg_queue->queue_mutex = &msg_queue_mutex;
-  msg_queue->queue_cond = &msg_queue_cond;
-  msg_queue->queue_len = 0;
+  // each worker fills its own slots and queue, so both stay
+  // single producer single consumer
+  msg_wake_t msg_wake;
+  msg_slots_t *msg_slots =
+      (msg_slots_t *)malloc(receivers * sizeof(*msg_slots));
+  msg_queue_t *msg_queues =
+      (msg_queue_t *)malloc(receivers * sizeof(*msg_queues));
+  if (!msg_slots || !msg_queues || !msg_wake_init(&msg_wake)) {
+    exit(EXIT_FAILURE);
+  }
+  for (uint16_t i = 0; i < receivers; i++) {
+    if (!msg_slots_init(&msg_slots[i], MSG_SLOT_COUNT, REC_BUFF_SIZE) ||
+        !msg_queue_init(&msg_queues[i], MSG_QUEUE_LEN, &msg_slots[i],
+                        &msg_wake)) {
+      exit(EXIT_FAILURE);
+    }
+  }
 
   pthread_mutex_lock(&routing_table_mutex);
 
@@ -65,45 +139,165 @@ void *router_main(void *arg) {
   sender_data_t sender_data = {interfaces, sockets, hello_table, routing_table,
                                data->cout_mutex};
 
-  pthread_t msg_receiver;
-  receiver_data_t receiver_data = {local_ips, sockets, msg_queue,
-                                   data->cout_mutex};
+  // workers are only pinned when there is more than one
+  long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t *msg_receivers =
+      (pthread_t *)malloc(receivers * sizeof(*msg_receivers));
+  receiver_data_t *receiver_data =
+      (receiver_data_t *)malloc(receivers * sizeof(*receiver_data));
+  if (!msg_receivers || !receiver_data) {
+    exit(EXIT_FAILURE);
+  }
+  for (uint16_t i = 0; i < receivers; i++) {
+    int cpu = receivers > 1 && cpu_count > 0 ? (int)(i % cpu_count) : -1;
+    receiver_data[i] = {local_ips,
+                        receiver_sockets(sockets, i, receivers),
+                        &msg_queues[i], hello_table, cpu};
+  }
+  nl_fib_t *kernel_fib = nl_fib_open();
+  if (!kernel_fib) {
+    exit(EXIT_FAILURE);
+  }
+
+  // Take over routes left in the kernel by a previous run
+  pthread_mutex_lock(&routing_table_mutex);
+  size_t adopted = adopt_kernel_routes(routing_table, kernel_fib);
+  pthread_mutex_unlock(&routing_table_mutex);
+  bool restart_pending = adopted > 0;
+
+  pthread_mutex_lock(data->cout_mutex);
+  std::cout << "Adopted " << adopted << " kernel routes" << std::endl;
+  pthread_mutex_unlock(data->cout_mutex);
+
+  pthread_mutex_t install_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t install_queue_cond = PTHREAD_COND_INITIALIZER;
+  slab_pool_t fib_change_pool;
+  slab_pool_init(&fib_change_pool, sizeof(fib_change_t),
+                 FIB_CHANGE_POOL_SLAB_COUNT);
+  install_queue_t *install_queue =
+      (install_queue_t *)malloc(sizeof(*install_queue));
+  install_queue_init(install_queue, &install_queue_mutex, &install_queue_cond,
+                     &fib_change_pool);
+
+  pthread_t fib_installer;
+  installer_data_t installer_data = {install_queue, kernel_fib};
+
   pthread_t msg_processor;
-  processor_data_t processor_data = {msg_queue, hello_table, routing_table,
-                                     data->cout_mutex};
+  processor_data_t processor_data = {
+      msg_queues,    receivers,     hello_table,     routing_table,
+      install_queue, &data->config, data->cout_mutex};
+
+  router_housekeeping_t housekeeping = {data,          hello_table,
+                                        routing_table, install_queue,
+                                        restart_pending, 0};
 
-  pthread_create(&msg_sender, NULL, sender_main, (void *)&sender_data);
-  pthread_create(&msg_receiver, NULL, receiver_main, (void *)&receiver_data);
   pthread_create(&msg_processor, NULL, processor_main, (void *)&processor_data);
+  pthread_create(&fib_installer, NULL, installer_main, (void *)&installer_data);
 
-  while (true) {
-    // Check for changes in immediate topology
-    pthread_mutex_lock(hello_table->table_mutex);
-    // bool added = data->hello_table->neighbor_added;
-    bool dead = hello_table->neighbor_dead;
-    pthread_mutex_unlock(hello_table->table_mutex);
+  // the io_uring loop takes over receiving, sending and housekeeping
+  // on this thread and only returns if it could not start or failed
+  if (data->config.io_uring) {
+    uring_main(&receiver_data[0], &sender_data, &housekeeping);
+  }
 
-    if (dead) {
-      pthread_mutex_lock(data->cout_mutex);
-      std::cout << "Processing topology change" << std::endl;
-      pthread_mutex_unlock(data->cout_mutex);
-      handle_dead_link(hello_table, routing_table);
-      print_routing_table(routing_table, data->cout_mutex);
-      pthread_mutex_lock(hello_table->table_mutex);
-      hello_table->neighbor_dead = false;
-      pthread_mutex_unlock(hello_table->table_mutex);
-    }
+  pthread_create(&msg_sender, NULL, sender_main, (void *)&sender_data);
+  for (uint16_t i = 0; i < receivers; i++) {
+    pthread_create(&msg_receivers[i], NULL, receiver_main,
+                   (void *)&receiver_data[i]);
+  }
+  if (receivers > 1) {
+    LOG_INFO("Started %u receiver workers", receivers);
+  }
 
-    std::this_thread::sleep_for(std::chrono::seconds(2));
+  while (true) {
+    router_housekeeping(&housekeeping);
+    std::this_thread::sleep_for(
+        std::chrono::seconds(HOUSEKEEPING_INTERVAL_SEC));
   }
 
   pthread_join(msg_sender, NULL);
-  pthread_join(msg_receiver, NULL);
+  for (uint16_t i = 0; i < receivers; i++) {
+    pthread_join(msg_receivers[i], NULL);
+  }
   pthread_join(msg_processor, NULL);
+  pthread_join(fib_installer, NULL);
 
   return EXIT_SUCCESS;
 }
 
+void router_housekeeping(router_housekeeping_t *state) {
+  hello_table_t *hello_table = state->hello_table;
+  dv_table_t *routing_table = state->routing_table;
+  install_queue_t *install_queue = state->install_queue;
+
+  // Check for changes in immediate topology
+  pthread_mutex_lock(hello_table->table_mutex);
+  // bool added = data->hello_table->neighbor_added;
+  bool dead = hello_table->neighbor_dead;
+  pthread_mutex_unlock(hello_table->table_mutex);
+
+  if (dead) {
+    LOG_INFO("Processing topology change");
+    handle_dead_link(hello_table, routing_table);
+    pthread_mutex_lock(routing_table->table_mutex);
+    sync_kernel_routes(routing_table, install_queue);
+    pthread_mutex_unlock(routing_table->table_mutex);
+    print_routing_table(routing_table, state->data->cout_mutex);
+    pthread_mutex_lock(hello_table->table_mutex);
+    hello_table->neighbor_dead = false;
+    pthread_mutex_unlock(hello_table->table_mutex);
+  }
+
+  // Retry route changes the install queue had no memory for,
+  // the processor otherwise only syncs after the next DV
+  pthread_mutex_lock(routing_table->table_mutex);
+  if (routing_table->dirty_count > 0) {
+    sync_kernel_routes(routing_table, install_queue);
+  }
+  pthread_mutex_unlock(routing_table->table_mutex);
+
+  // Once converged, drop adopted routes nobody relearned
+  if (state->restart_pending) {
+    pthread_mutex_lock(routing_table->table_mutex);
+    double quiet = difftime(time(NULL), routing_table->last_change);
+    if (quiet >= state->data->config.restart_grace) {
+      size_t stale = flush_stale_routes(routing_table, install_queue);
+      state->restart_pending = false;
+
+      LOG_INFO("Restart grace period over, removing %zu stale kernel routes",
+               stale);
+    }
+    pthread_mutex_unlock(routing_table->table_mutex);
+  }
+
+  // Report when kernel programming falls behind
+  install_stats_t install_stats = get_install_stats(install_queue);
+  if (install_stats.depth > 0) {
+    LOG_WARN("Installer backlog: %zu routes, lag %.1f ms", install_stats.depth,
+             install_stats.lag_ms);
+  }
+
+  // Report heap calls on the processor path, they only
+  // grow while the pools warm up or the table grows
+  pthread_mutex_lock(routing_table->table_mutex);
+  size_t dest_slabs = routing_table->dest_pool.heap_allocs;
+  size_t trie_slabs = routing_table->fib->node_pool.heap_allocs;
+  pthread_mutex_unlock(routing_table->table_mutex);
+  pthread_mutex_lock(hello_table->table_mutex);
+  size_t neighbor_allocs = hello_table->heap_allocs;
+  pthread_mutex_unlock(hello_table->table_mutex);
+
+  size_t heap_allocs = dest_slabs + trie_slabs + install_stats.change_slabs +
+                       neighbor_allocs;
+  if (heap_allocs != state->heap_allocs) {
+    state->heap_allocs = heap_allocs;
+    LOG_INFO("Heap allocs: %zu dest slabs, %zu trie slabs, %zu route change "
+             "slabs, %zu neighbor entries",
+             dest_slabs, trie_slabs, install_stats.change_slabs,
+             neighbor_allocs);
+  }
+}
+
 interface_list_t get_interfaces(pthread_mutex_t *cout_mutex) {
   struct ifaddrs *ifaddr, *ifa;
 
@@ -143,6 +337,7 @@ interface_list_t get_interfaces(pthread_mutex_t *cout_mutex) {
 
       interface_info_t info;
       strcpy(info.name, ifa->ifa_name);
+      info.ifindex = if_nametoindex(ifa->ifa_name);
 
       char ip[INET_ADDRSTRLEN];
       void *addr_ptr = &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
@@ -186,7 +381,7 @@ interface_list_t get_interfaces(pthread_mutex_t *cout_mutex) {
   }
 
   freeifaddrs(ifaddr);
-  return {interfaces, int_count};
+  return {interfaces, i};
 }
 
 local_ip_list_t get_local_ips(interface_list_t interfaces) {
@@ -207,6 +402,10 @@ socket_list_t bind_sockets(interface_list_t interfaces,
 
   for (uint16_t i = 0; i < interfaces.count; i++) {
     interface_info_t iface = interfaces.interfaces[i];
+    // unusable until bound below
+    sockets[i] = (router_socket_t){"", -1};
+    strcpy(sockets[i].name, iface.name);
+
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) {
       pthread_mutex_lock(cout_mutex);
@@ -225,6 +424,11 @@ socket_list_t bind_sockets(interface_list_t interfaces,
       pthread_mutex_unlock(cout_mutex);
     }
 
+    // kernel receive times, for HELLO latency
+    int enable_timestamp = 1;
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &enable_timestamp,
+               sizeof(enable_timestamp));
+
     int enable_broadcast = 1;
     setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &enable_broadcast,
                sizeof(enable_broadcast));
@@ -251,14 +455,248 @@ socket_list_t bind_sockets(interface_list_t interfaces,
     pthread_mutex_unlock(cout_mutex);
   }
 
-  return {sockets, interfaces.count};
+  return {sockets, interfaces.count, false, NULL, 0};
+}
+
+socket_list_t bind_shared_socket(interface_list_t interfaces,
+                                 pthread_mutex_t *cout_mutex) {
+  router_socket_t *shared = (router_socket_t *)malloc(sizeof(*shared));
+  *shared = (router_socket_t){"*", -1};
+
+  int max_ifindex = 0;
+  for (uint16_t i = 0; i < interfaces.count; i++) {
+    if (interfaces.interfaces[i].ifindex > max_ifindex) {
+      max_ifindex = interfaces.interfaces[i].ifindex;
+    }
+  }
+  router_socket_t *by_ifindex =
+      (router_socket_t *)malloc((max_ifindex + 1) * sizeof(*by_ifindex));
+  for (int i = 0; i <= max_ifindex; i++) {
+    by_ifindex[i] = (router_socket_t){"", -1};
+  }
+
+  socket_list_t sockets = {shared, 1, true, by_ifindex, max_ifindex};
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    pthread_mutex_lock(cout_mutex);
+    std::cout << "ERROR: socket not bound" << std::endl;
+    pthread_mutex_unlock(cout_mutex);
+    return sockets;
+  }
+
+  int enable_reuse = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable_reuse,
+             sizeof(enable_reuse));
+
+  // the receiving interface arrives as ancillary data
+  int enable_pktinfo = 1;
+  if (setsockopt(sock, IPPROTO_IP, IP_PKTINFO, &enable_pktinfo,
+                 sizeof(enable_pktinfo)) < 0) {
+    pthread_mutex_lock(cout_mutex);
+    std::cout << "ERROR: cannot enable IP_PKTINFO" << std::endl;
+    pthread_mutex_unlock(cout_mutex);
+    close(sock);
+    return sockets;
+  }
+
+  // kernel receive times, for HELLO latency
+  int enable_timestamp = 1;
+  setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &enable_timestamp,
+             sizeof(enable_timestamp));
+
+  int enable_broadcast = 1;
+  setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &enable_broadcast,
+             sizeof(enable_broadcast));
+
+  struct sockaddr_in addr;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(PROTOCOL_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (::bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    pthread_mutex_lock(cout_mutex);
+    std::cout << "ERROR: could not bind socket" << std::endl;
+    pthread_mutex_unlock(cout_mutex);
+    close(sock);
+    return sockets;
+  }
+
+  shared->fd = sock;
+  for (uint16_t i = 0; i < interfaces.count; i++) {
+    interface_info_t iface = interfaces.interfaces[i];
+    if (iface.ifindex <= 0) {
+      continue;
+    }
+    by_ifindex[iface.ifindex].fd = sock;
+    strcpy(by_ifindex[iface.ifindex].name, iface.name);
+  }
+
+  pthread_mutex_lock(cout_mutex);
+  std::cout << "Bound shared socket " << sock << " to " << interfaces.count
+            << " interfaces" << std::endl;
+  pthread_mutex_unlock(cout_mutex);
+
+  return sockets;
+}
+
+// interface a shared socket datagram arrived on, NULL if not ours
+router_socket_t *socket_for_ifindex(socket_list_t *sockets, int ifindex) {
+  if (ifindex <= 0 || ifindex > sockets->max_ifindex ||
+      sockets->by_ifindex[ifindex].fd < 0) {
+    return NULL;
+  }
+  return &sockets->by_ifindex[ifindex];
+}
+
+// fills msg to send the iov array out of interface i and returns
+// the socket, control must hold SEND_CONTROL_LEN bytes
+int prepare_interface_msg(socket_list_t *sockets, uint16_t i,
+                          interface_info_t *iface, struct msghdr *msg,
+                          const struct iovec *iov, size_t iov_count,
+                          char *control, struct sockaddr_in *dest_addr) {
+  memset(msg, 0, sizeof(*msg));
+  msg->msg_name = dest_addr;
+  msg->msg_namelen = sizeof(*dest_addr);
+  msg->msg_iov = (struct iovec *)iov;
+  msg->msg_iovlen = iov_count;
+
+  if (!sockets->shared) {
+    return sockets->sockets[i].fd;
+  }
+
+  // IP_PKTINFO picks the outgoing interface and source address
+  memset(control, 0, SEND_CONTROL_LEN);
+  msg->msg_control = control;
+  msg->msg_controllen = SEND_CONTROL_LEN;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+  cmsg->cmsg_level = IPPROTO_IP;
+  cmsg->cmsg_type = IP_PKTINFO;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+
+  struct in_pktinfo pktinfo;
+  memset(&pktinfo, 0, sizeof(pktinfo));
+  pktinfo.ipi_ifindex = iface->ifindex;
+  memcpy(&pktinfo.ipi_spec_dst, &iface->addr, sizeof(pktinfo.ipi_spec_dst));
+  memcpy(CMSG_DATA(cmsg), &pktinfo, sizeof(pktinfo));
+
+  return sockets->sockets[0].fd;
+}
+
+ssize_t send_on_interface(socket_list_t *sockets, uint16_t i,
+                          interface_info_t *iface, const struct iovec *iov,
+                          size_t iov_count, struct sockaddr_in *dest_addr) {
+  char control[SEND_CONTROL_LEN];
+  struct msghdr msg;
+  int fd = prepare_interface_msg(sockets, i, iface, &msg, iov, iov_count,
+                                 control, dest_addr);
+  return sendmsg(fd, &msg, 0);
+}
+
+bool msg_slots_init(msg_slots_t *slots, size_t count, size_t buf_size) {
+  // each slot is an entry with its msg_str buffer right behind it
+  size_t slot_size = sizeof(msg_queue_entry_t) + buf_size;
+  slot_size = (slot_size + 63) & ~(size_t)63;
+
+  slots->storage = (char *)malloc(count * slot_size);
+  if (!slots->storage) {
+    return false;
+  }
+  if (!spsc_ring_init(&slots->free_ring, count)) {
+    free(slots->storage);
+    return false;
+  }
+  slots->slot_size = slot_size;
+  slots->count = count;
+  slots->drops = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    msg_queue_entry_t *entry =
+        (msg_queue_entry_t *)(slots->storage + i * slot_size);
+    entry->msg_str = (char *)(entry + 1);
+    spsc_ring_push(&slots->free_ring, entry);
+  }
+  return true;
+}
+
+// receiver side
+msg_queue_entry_t *msg_slot_take(msg_slots_t *slots) {
+  return (msg_queue_entry_t *)spsc_ring_pop(&slots->free_ring);
+}
+
+// processor side
+void msg_slot_release(msg_slots_t *slots, msg_queue_entry_t *entry) {
+  spsc_ring_push(&slots->free_ring, entry);
+}
+
+bool msg_wake_init(msg_wake_t *wake) {
+  wake->fd = eventfd(0, EFD_CLOEXEC);
+  wake->consumer_idle = 0;
+  return wake->fd >= 0;
+}
+
+bool msg_queue_init(msg_queue_t *queue, size_t capacity, msg_slots_t *slots,
+                    msg_wake_t *wake) {
+  if (!spsc_ring_init(&queue->ring, capacity)) {
+    return false;
+  }
+  queue->wake = wake;
+  queue->slots = slots;
+  queue->drops = 0;
+  queue->coalesced = 0;
+  queue->high_water = 0;
+  queue->received = 0;
+  queue->wakeups = 0;
+  queue->has_cpu_clock = 0;
+  return true;
+}
+
+// receiver side, called on the thread that fills the queue
+void msg_queue_set_receiver(msg_queue_t *queue) {
+  if (pthread_getcpuclockid(pthread_self(), &queue->cpu_clock) == 0) {
+    __atomic_store_n(&queue->has_cpu_clock, 1, __ATOMIC_RELEASE);
+  }
+}
+
+// cpu seconds the receiving thread has used so far, 0 before it starts
+double msg_queue_cpu_sec(msg_queue_t *queue) {
+  struct timespec ts;
+  if (!__atomic_load_n(&queue->has_cpu_clock, __ATOMIC_ACQUIRE) ||
+      clock_gettime(queue->cpu_clock, &ts) != 0) {
+    return 0;
+  }
+  return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
 void print_hello_table(hello_table_t *table, pthread_mutex_t *cout_mutex) {
   if (!table)
     return;
 
+  // copy the entries out so the receiver's HELLO updates
+  // never wait on the table lock while we write to stdout
   pthread_mutex_lock(table->table_mutex);
+  size_t count = 0;
+  for (hello_entry_t *curr = table->head; curr != NULL; curr = curr->next) {
+    count++;
+  }
+  hello_entry_t *entries =
+      (hello_entry_t *)malloc((count ? count : 1) * sizeof(*entries));
+  if (!entries) {
+    pthread_mutex_unlock(table->table_mutex);
+    return;
+  }
+  count = 0;
+  for (hello_entry_t *curr = table->head; curr != NULL; curr = curr->next) {
+    entries[count++] = *curr;
+  }
+  size_t hello_count = table->hello_count;
+  uint64_t latency_total = table->hello_latency_total;
+  uint64_t latency_max = table->hello_latency_max;
+  pthread_mutex_unlock(table->table_mutex);
+
   pthread_mutex_lock(cout_mutex);
 
   std::cout << "\n==================== NEIGHBOR TABLE "
@@ -276,10 +714,10 @@ void print_hello_table(hello_table_t *table, pthread_mutex_t *cout_mutex) {
   std::cout << "---------------------------------------------------------------"
             << std::endl;
 
-  hello_entry_t *curr = table->head;
   time_t now = time(NULL);
 
-  while (curr != NULL) {
+  for (size_t i = 0; i < count; i++) {
+    hello_entry_t *curr = &entries[i];
     char *ip_str = get_str_from_addr(curr->ip);
 
     // Calculate Age
@@ -302,63 +740,151 @@ void print_hello_table(hello_table_t *table, pthread_mutex_t *cout_mutex) {
     // clang-format on
 
     free(ip_str);
-    curr = curr->next;
   }
 
-  if (table->head == NULL) {
+  if (count == 0) {
     std::cout << "(No neighbors discovered yet)\n";
   }
 
   std::cout << "---------------------------------------------------------------"
             << std::endl;
+  if (hello_count > 0) {
+    std::cout << "HELLO latency: avg " << latency_total / hello_count
+              << " us, max " << latency_max << " us over " << hello_count
+              << " HELLOs" << std::endl;
+  }
 
   pthread_mutex_unlock(cout_mutex);
-  pthread_mutex_unlock(table->table_mutex);
+  free(entries);
 }
 
-void sync_kernel_routes(dv_table_t *table, pthread_mutex_t *cout_mutex) {
-  dv_dest_entry_t *dest = table->head;
+// hands every dirty destination whose next hop set differs
+// from the one last requested to the installer thread
+void sync_kernel_routes(dv_table_t *table, install_queue_t *install_queue) {
+  dv_dest_entry_t *dest = dv_take_dirty(table);
+  uint8_t direct = dv_find_neighbor(table, (ip_addr_t){0, 0, 0, 0});
+  size_t changes = 0;
+
+  // one DV advertisement covers everything taken off the dirty list
+  if (dest != NULL) {
+    dv_update(table);
+  }
+
+  pthread_mutex_lock(install_queue->queue_mutex);
 
   while (dest != NULL) {
-    if (dest->best != dest->installed) {
+    // a failed push puts dest back on the dirty list
+    dv_dest_entry_t *next = dest->dirty_next;
+    dest->dirty = false;
 
-      char *dest_str = get_str_from_subnet(dest->dest);
+    if (dest->best_mask != dest->installed) {
 
       // New route is valid, old was NULL/different
-      if (dest->best != NULL && dest->best_cost < INFINITY_COST) {
-
-        char *gw_ip = get_str_from_addr(dest->best->neighbor_addr);
-        char cmd[256];
+      if (dest->best_mask != 0 && dest->best_cost < INFINITY_COST) {
 
         // Check if this is a "Direct" route (GW is 0.0.0.0)
-        if (!addr_cmpr(dest->best->neighbor_addr, (ip_addr_t){0, 0, 0, 0})) {
-          snprintf(cmd, sizeof(cmd), "ip route replace %s via %s", dest_str,
-                   gw_ip);
-          pthread_mutex_lock(cout_mutex);
-          std::cout << "Running command: " << cmd << std::endl;
-          pthread_mutex_unlock(cout_mutex);
-          system(cmd);
+        if (direct == DV_NO_NEIGHBOR ||
+            !(dest->best_mask & (1ULL << direct))) {
+          ip_addr_t gateways[DV_MAX_PATHS];
+          uint8_t n_gateways = 0;
+          uint64_t mask = dest->best_mask;
+          while (mask != 0 && n_gateways < DV_MAX_PATHS) {
+            gateways[n_gateways++] = table->neighbors[__builtin_ctzll(mask)];
+            mask &= mask - 1;
+          }
+          if (!install_queue_push(install_queue, dest->dest, gateways,
+                                  n_gateways)) {
+            dv_mark_dirty(table, dest);
+            dest = next;
+            continue;
+          }
+          changes++;
         }
-        free(gw_ip);
 
-        dest->installed = dest->best;
+        dv_set_installed(table, dest, dest->best_mask);
       }
       // New route is INVALID (Infinity/NULL), old was valid
-      else if (dest->installed != NULL) {
-        // Route became unreachable -> Delete it
-        char cmd[256];
-        snprintf(cmd, sizeof(cmd), "ip route del %s", dest_str);
-        pthread_mutex_lock(cout_mutex);
-        std::cout << "Running command: " << cmd << std::endl;
-        pthread_mutex_unlock(cout_mutex);
-        system(cmd);
-
-        dest->installed = NULL;
+      else if (dest->installed != 0) {
+        // Route became unreachable -> Delete it, retried on the
+        // next sync so the kernel is never left with a stale route
+        if (install_queue_push(install_queue, dest->dest, NULL, 0)) {
+          changes++;
+          dv_set_installed(table, dest, 0);
+        } else {
+          dv_mark_dirty(table, dest);
+        }
+      }
+    }
+
+    dest = next;
+  }
+
+  pthread_mutex_unlock(install_queue->queue_mutex);
+
+  if (changes > 0) {
+    pthread_cond_signal(install_queue->queue_cond);
+
+    LOG_INFO("Queued %zu kernel route changes", changes);
+  }
+}
+
+// seeds installed from routes a previous run left in the
+// kernel so relearning the same next hop is a no-op
+size_t adopt_kernel_routes(dv_table_t *table, nl_fib_t *fib) {
+  nl_route_t *routes;
+  size_t count = nl_fib_dump_owned(fib, &routes);
+  size_t adopted = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    uint64_t installed = 0;
+    for (uint8_t j = 0; j < routes[i].n_gateways; j++) {
+      uint8_t gateway = dv_intern_neighbor(table, routes[i].gateways[j]);
+      if (gateway != DV_NO_NEIGHBOR) {
+        installed |= 1ULL << gateway;
       }
+    }
 
-      free(dest_str);
+    dv_dest_entry_t *dest = dv_insert_dest(table, routes[i].dest);
+    if (installed == 0 || dest == NULL) {
+      continue;
+    }
+    dv_set_installed(table, dest, installed);
+    if (dest->known == 0) {
+      dest->adopted = true;
     }
+    adopted++;
+  }
+
+  free(routes);
+  return adopted;
+}
+
+// deletes installed routes that have no valid best route,
+// run once the table has been stable for the grace period
+size_t flush_stale_routes(dv_table_t *table, install_queue_t *install_queue) {
+  size_t stale = 0;
+
+  pthread_mutex_lock(install_queue->queue_mutex);
 
+  dv_dest_entry_t *dest = table->head;
+  while (dest != NULL) {
+    if (dest->installed != 0 &&
+        (dest->best_mask == 0 || dest->best_cost >= INFINITY_COST)) {
+      // still installed, so the next sync retries the delete
+      if (install_queue_push(install_queue, dest->dest, NULL, 0)) {
+        dv_set_installed(table, dest, 0);
+        stale++;
+      } else {
+        dv_mark_dirty(table, dest);
+      }
+    }
     dest = dest->next;
   }
+
+  pthread_mutex_unlock(install_queue->queue_mutex);
+
+  if (stale > 0) {
+    pthread_cond_signal(install_queue->queue_cond);
+  }
+  return stale;
 }
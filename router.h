@@ -14,16 +14,33 @@
 #include <unistd.h>
 #include <vector>
 
+#include "config.h"
+#include "installer.h"
 #include "network.h"
+#include "ring.h"
 
 #ifndef SO_BINDTODEVICE
 #define SO_BINDTODEVICE 25
 #endif
 
-#define MSG_QUEUE_LEN 10
+// messages waiting for the processor, DV chunks from a sender
+// that already has the same chunk queued are coalesced and do
+// not count
+#define MSG_QUEUE_LEN 128
+
+// preallocated receive buffers shared by receiver and processor,
+// enough for a full queue plus the receiver's reserved batch
+#define MSG_SLOT_COUNT 256
+
+// objects carved per slab malloc
+#define DEST_POOL_SLAB_COUNT 256
+#define FIB_CHANGE_POOL_SLAB_COUNT 256
 
 #define PROTOCOL_PORT 5555
 
+// ancillary space for the IP_PKTINFO of a shared socket send
+#define SEND_CONTROL_LEN CMSG_SPACE(sizeof(struct in_pktinfo))
+
 typedef struct router_msg_t {
   router_msg_t *next;
   char *msg;
@@ -38,24 +55,61 @@ typedef struct router_msg_box_t {
 typedef struct router_data_t {
   pthread_mutex_t *cout_mutex;
   int router_id;
+  router_config_t config;
 } router_data_t;
 
 typedef struct msg_queue_entry_t {
-  msg_queue_entry_t *next;
   char *msg_str;
+  // datagram length, binary DVs may hold NUL bytes
+  size_t len;
   char int_name[16];
+  ip_addr_t sender;
+  msg_type_t type;
+  // DV chunk index, only the same chunk of a DV is coalesced
+  uint16_t chunk;
 } msg_queue_entry_t;
 
+// fixed set of entries with msg_str buffers, the receiver takes
+// free slots and the processor hands them back when done
+typedef struct msg_slots_t {
+  char *storage;
+  size_t slot_size;
+  size_t count;
+  spsc_ring_t free_ring;
+
+  // datagrams discarded because every slot was in use
+  size_t drops;
+} msg_slots_t;
+
+// shared by every receiver queue, the processor only
+// sleeps on fd once it has found all of them empty
+typedef struct msg_wake_t {
+  int fd;
+  int consumer_idle;
+} msg_wake_t;
+
+// bounded queue from one receiver worker to the processor
 typedef struct msg_queue_t {
-  msg_queue_entry_t *head;
-  msg_queue_entry_t *tail;
-  pthread_mutex_t *queue_mutex;
-  pthread_cond_t *queue_cond;
-  size_t queue_len;
+  spsc_ring_t ring;
+  msg_wake_t *wake;
+  msg_slots_t *slots;
+
+  // written by the receiver only
+  size_t drops;
+  size_t coalesced;
+  size_t high_water;
+  // datagrams read and times the receiver woke up to read them
+  size_t received;
+  size_t wakeups;
+
+  // cpu time of the receiving thread, valid once has_cpu_clock is set
+  clockid_t cpu_clock;
+  int has_cpu_clock;
 } msg_queue_t;
 
 typedef struct interface_info_t {
   char name[16];
+  int ifindex;
   ip_addr_t addr;
   ip_addr_t broadcast_addr;
   ip_subnet_t subnet;
@@ -74,6 +128,12 @@ typedef struct router_socket_t {
 typedef struct socket_list_t {
   router_socket_t *sockets;
   uint16_t count;
+
+  // shared mode: sockets holds one socket for every interface,
+  // received datagrams are attributed through IP_PKTINFO
+  bool shared;
+  router_socket_t *by_ifindex;
+  int max_ifindex;
 } socket_list_t;
 
 typedef struct local_ip_list_t {
@@ -88,6 +148,8 @@ typedef struct hello_entry_t {
   uint16_t last_sn;
   time_t last_seen;
   bool alive;
+  // HELLO_CAP_* bits from the neighbor's last HELLO
+  uint8_t caps;
   char int_name[16];
 } hello_entry_t;
 
@@ -96,10 +158,34 @@ typedef struct hello_table_t {
   pthread_mutex_t *table_mutex;
   bool neighbor_added;
   bool neighbor_dead;
+
+  // kernel receive to table update, in microseconds
+  size_t hello_count;
+  uint64_t hello_latency_total;
+  uint64_t hello_latency_max;
+
+  // entry mallocs, one per neighbor ever heard
+  size_t heap_allocs;
 } hello_table_t;
 
+// state for the periodic topology and installer checks
+typedef struct router_housekeeping_t {
+  router_data_t *data;
+  hello_table_t *hello_table;
+  dv_table_t *routing_table;
+  install_queue_t *install_queue;
+  bool restart_pending;
+  // heap calls at the last report
+  size_t heap_allocs;
+} router_housekeeping_t;
+
+// seconds between housekeeping runs
+#define HOUSEKEEPING_INTERVAL_SEC 2
+
 void *router_main(void *arg);
 
+void router_housekeeping(router_housekeeping_t *state);
+
 interface_list_t get_interfaces(pthread_mutex_t *cout_mutex);
 
 local_ip_list_t get_local_ips(interface_list_t interfaces);
@@ -107,8 +193,41 @@ local_ip_list_t get_local_ips(interface_list_t interfaces);
 socket_list_t bind_sockets(interface_list_t interfaces,
                            pthread_mutex_t *cout_mutex);
 
+socket_list_t bind_shared_socket(interface_list_t interfaces,
+                                 pthread_mutex_t *cout_mutex);
+
+router_socket_t *socket_for_ifindex(socket_list_t *sockets, int ifindex);
+
+int prepare_interface_msg(socket_list_t *sockets, uint16_t i,
+                          interface_info_t *iface, struct msghdr *msg,
+                          const struct iovec *iov, size_t iov_count,
+                          char *control, struct sockaddr_in *dest_addr);
+
+ssize_t send_on_interface(socket_list_t *sockets, uint16_t i,
+                          interface_info_t *iface, const struct iovec *iov,
+                          size_t iov_count, struct sockaddr_in *dest_addr);
+
+bool msg_slots_init(msg_slots_t *slots, size_t count, size_t buf_size);
+
+msg_queue_entry_t *msg_slot_take(msg_slots_t *slots);
+
+void msg_slot_release(msg_slots_t *slots, msg_queue_entry_t *entry);
+
+bool msg_wake_init(msg_wake_t *wake);
+
+bool msg_queue_init(msg_queue_t *queue, size_t capacity, msg_slots_t *slots,
+                    msg_wake_t *wake);
+
+void msg_queue_set_receiver(msg_queue_t *queue);
+
+double msg_queue_cpu_sec(msg_queue_t *queue);
+
 void print_hello_table(hello_table_t *table, pthread_mutex_t *cout_mutex);
 
-void sync_kernel_routes(dv_table_t *table, pthread_mutex_t *cout_mutex);
+void sync_kernel_routes(dv_table_t *table, install_queue_t *install_queue);
+
+size_t adopt_kernel_routes(dv_table_t *table, nl_fib_t *fib);
+
+size_t flush_stale_routes(dv_table_t *table, install_queue_t *install_queue);
 
 #endif
@@ -1,104 +1,224 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <pthread.h>
 #include <sys/socket.h>
 
+#include "log.h"
 #include "router.h"
 #include "sender.h"
 
-void *sender_main(void *arg) {
-  sender_data_t *data = (sender_data_t *)arg;
-  uint16_t sn = 0;
-  uint16_t dv_counter = 0;
-  while (true) {
-    // Check for liveness
-    bool dying = false;
-    pthread_mutex_lock(data->hello_table->table_mutex);
-    hello_entry_t *current_entry = data->hello_table->head;
-    while (current_entry != NULL) {
-      time_t current_time = time(NULL);
-      double age_seconds = difftime(current_time, current_entry->last_seen);
-      if (age_seconds > 10 && current_entry->alive) {
-        current_entry->alive = false;
-        dying = true;
-        pthread_mutex_lock(data->cout_mutex);
-        std::cout << "Link " << current_entry->int_name << " is dead"
-                  << std::endl;
-        pthread_mutex_unlock(data->cout_mutex);
-      }
-      current_entry = current_entry->next;
+static ssize_t send_socket(void *ctx, uint16_t i, const struct iovec *iov,
+                           size_t iov_count, struct sockaddr_in *dest_addr) {
+  sender_data_t *data = (sender_data_t *)ctx;
+  return send_on_interface(&data->sockets, i, &data->interfaces.interfaces[i],
+                           iov, iov_count, dest_addr);
+}
+
+// true if every live neighbor on int_name sent all of caps, a
+// broadcast has to be understood by each of them
+static bool peers_support(hello_table_t *table, const char *int_name,
+                          uint8_t caps) {
+  bool any = false;
+  bool all = true;
+  pthread_mutex_lock(table->table_mutex);
+  for (hello_entry_t *entry = table->head; entry != NULL;
+       entry = entry->next) {
+    if (!entry->alive || strcmp(entry->int_name, int_name) != 0) {
+      continue;
     }
-    if (dying) {
-      data->hello_table->neighbor_dead = true;
+    any = true;
+    if ((entry->caps & caps) != caps) {
+      all = false;
+      break;
     }
-    pthread_mutex_unlock(data->hello_table->table_mutex);
+  }
+  pthread_mutex_unlock(table->table_mutex);
+  return any && all;
+}
 
-    print_hello_table(data->hello_table, data->cout_mutex);
+static void broadcast_dest(interface_info_t *iface,
+                           struct sockaddr_in *dest_addr) {
+  memset(dest_addr, 0, sizeof(*dest_addr));
+  dest_addr->sin_family = AF_INET;
+  dest_addr->sin_port = htons(PROTOCOL_PORT);
 
-    // Send HELLOs
-    for (size_t i = 0; i < data->sockets.count; i++) {
-      struct sockaddr_in dest_addr;
-      memset(&dest_addr, 0, sizeof(dest_addr));
-      dest_addr.sin_family = AF_INET;
-      dest_addr.sin_port = htons(PROTOCOL_PORT);
+  char *broadcast_addr = get_str_from_addr(iface->broadcast_addr);
+  inet_pton(AF_INET, broadcast_addr, &dest_addr->sin_addr);
+  free(broadcast_addr);
+}
 
-      char *broadcast_addr =
-          get_str_from_addr(data->interfaces.interfaces[i].broadcast_addr);
-      inet_pton(AF_INET, broadcast_addr, &dest_addr.sin_addr);
-      free(broadcast_addr);
+// moves the pending round on to the first chunk of the next
+// interface, dropping the snapshot after the last one
+static void next_interface(sender_data_t *data, sender_state_t *state) {
+  state->pending_iface++;
+  state->pending_chunk = 0;
+  if (state->pending_iface >= data->interfaces.count) {
+    dv_snapshot_release(state->pending);
+    state->pending = NULL;
+  }
+}
 
-      char *local_ip = get_str_from_addr(data->interfaces.interfaces[i].addr);
-      std::string message = std::string(local_ip);
-      message += ":HELLO:";
+bool sender_pace(sender_data_t *data, sender_state_t *state,
+                 sender_send_fn send, void *ctx) {
+  int burst = 0;
+  while (state->pending != NULL && burst < DV_PACE_BURST) {
+    interface_info_t *iface =
+        &data->interfaces.interfaces[state->pending_iface];
 
-      uint16_t sn_net_order = htons(sn);
+    // the body is the same on every interface using the same
+    // format, only the header differs
+    if (state->pending_chunk == 0) {
+      state->pending_binary =
+          peers_support(data->hello_table, iface->name, HELLO_CAP_BINARY_DV);
+    }
+    bool binary = state->pending_binary;
+    dv_encoding_t *enc = binary ? &state->dv_binary : &state->dv_text;
+    if (!(binary ? dv_encode_binary(state->pending, enc)
+                 : dv_encode(state->pending, enc))) {
+      LOG_ERROR("Could not encode DV");
+      next_interface(data, state);
+      continue;
+    }
+
+    struct sockaddr_in dest_addr;
+    broadcast_dest(iface, &dest_addr);
 
-      message.append(reinterpret_cast<const char *>(&sn_net_order),
-                     sizeof(sn_net_order));
+    size_t chunk = state->pending_chunk;
+    char header[DV_HEADER_MAX];
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len =
+        binary ? dv_encode_binary_header(iface->addr, enc, chunk, header)
+               : dv_encode_header(iface->addr, enc, chunk, header);
+    iov[1].iov_base = (void *)dv_encoding_chunk(enc, chunk, &iov[1].iov_len);
 
-      ssize_t bytes_sent =
-          sendto(data->sockets.sockets[i].fd, message.data(), message.size(), 0,
-                 (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    ssize_t bytes_sent = send(ctx, state->pending_iface, iov, 2, &dest_addr);
+    LOG_DEBUG("Sent %s DV Update chunk %zu of %zu on %s (Bytes: %zd)",
+              binary ? "binary" : "text", chunk, enc->chunk_count,
+              iface->name, bytes_sent);
+    burst++;
 
-      pthread_mutex_lock(data->cout_mutex);
-      std::cout << "Sent HELLO on " << data->interfaces.interfaces[i].name
-                << " (SN: " << sn << ", Bytes: " << bytes_sent << ")"
-                << std::endl;
-      pthread_mutex_unlock(data->cout_mutex);
+    if (++state->pending_chunk == enc->chunk_count) {
+      next_interface(data, state);
     }
+  }
+  return state->pending != NULL;
+}
+
+bool sender_tick(sender_data_t *data, sender_state_t *state,
+                 sender_send_fn send, void *ctx) {
+  uint16_t sn = state->sn;
 
-    // Send DV Updates
-    char *dv_msg;
-    pthread_mutex_lock(data->routing_table->table_mutex);
-    if (data->routing_table->update_dv || dv_counter > 4) {
-      for (size_t i = 0; i < data->sockets.count; i++) {
-        struct sockaddr_in dest_addr;
-        memset(&dest_addr, 0, sizeof(dest_addr));
-        dest_addr.sin_family = AF_INET;
-        dest_addr.sin_port = htons(PROTOCOL_PORT);
-
-        char *broadcast_addr =
-            get_str_from_addr(data->interfaces.interfaces[i].broadcast_addr);
-        inet_pton(AF_INET, broadcast_addr, &dest_addr.sin_addr);
-        free(broadcast_addr);
-
-        dv_msg = get_distance_vector(data->routing_table,
-                                     data->interfaces.interfaces[i].addr);
-
-        ssize_t bytes_sent =
-            sendto(data->sockets.sockets[i].fd, dv_msg, strlen(dv_msg), 0,
-                   (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        pthread_mutex_lock(data->cout_mutex);
-        std::cout << "Sent DV Update on " << data->interfaces.interfaces[i].name
-                  << " (Bytes: " << bytes_sent << ")" << std::endl;
-        pthread_mutex_unlock(data->cout_mutex);
-      }
+  // Check for liveness
+  bool dying = false;
+  pthread_mutex_lock(data->hello_table->table_mutex);
+  hello_entry_t *current_entry = data->hello_table->head;
+  while (current_entry != NULL) {
+    time_t current_time = time(NULL);
+    double age_seconds = difftime(current_time, current_entry->last_seen);
+    if (age_seconds > 10 && current_entry->alive) {
+      current_entry->alive = false;
+      dying = true;
+      LOG_WARN("Link %s is dead", current_entry->int_name);
+    }
+    current_entry = current_entry->next;
+  }
+  if (dying) {
+    data->hello_table->neighbor_dead = true;
+  }
+  pthread_mutex_unlock(data->hello_table->table_mutex);
+
+  // the dump blocks on cout_mutex, and in the io_uring loop
+  // this runs on the receive path
+  if (log_enabled(LOG_LEVEL_DEBUG)) {
+    print_hello_table(data->hello_table, data->cout_mutex);
+  }
+
+  // Send HELLOs
+  for (uint16_t i = 0; i < data->interfaces.count; i++) {
+    struct sockaddr_in dest_addr;
+    broadcast_dest(&data->interfaces.interfaces[i], &dest_addr);
+
+    char *local_ip = get_str_from_addr(data->interfaces.interfaces[i].addr);
+    std::string message = std::string(local_ip);
+    message += ":HELLO:";
+    free(local_ip);
+
+    uint16_t sn_net_order = htons(sn);
+
+    message.append(reinterpret_cast<const char *>(&sn_net_order),
+                   sizeof(sn_net_order));
+    // older routers read only the SN and ignore this
+    message += (char)HELLO_CAP_BINARY_DV;
+
+    struct iovec iov = {(void *)message.data(), message.size()};
+    ssize_t bytes_sent = send(ctx, i, &iov, 1, &dest_addr);
+
+    LOG_DEBUG("Sent HELLO on %s (SN: %u, Bytes: %zd)",
+              data->interfaces.interfaces[i].name, sn, bytes_sent);
+  }
+
+  // Send DV Updates, from a snapshot so the processor keeps
+  // applying updates while the DVs are encoded and sent, a round
+  // still being paced out finishes before the next one starts
+  dv_snapshot_t *snap = NULL;
+  pthread_mutex_lock(data->routing_table->table_mutex);
+  if (state->pending == NULL && data->interfaces.count > 0 &&
+      (data->routing_table->update_dv || state->dv_counter > 4)) {
+    snap = dv_snapshot_take(data->routing_table);
+    if (snap) {
       dv_sent(data->routing_table);
-      dv_counter = 0;
     }
-    pthread_mutex_unlock(data->routing_table->table_mutex);
+  }
+  pthread_mutex_unlock(data->routing_table->table_mutex);
+
+  if (snap) {
+    state->pending = snap;
+    state->pending_iface = 0;
+    state->pending_chunk = 0;
+    state->dv_counter = 0;
+  }
+
+  state->sn++;
+  state->dv_counter++;
+  return sender_pace(data, state, send, ctx);
+}
+
+void sender_state_init(sender_state_t *state) {
+  state->sn = 0;
+  state->dv_counter = 0;
+  dv_encoding_init(&state->dv_text);
+  dv_encoding_init(&state->dv_binary);
+  state->pending = NULL;
+  state->pending_iface = 0;
+  state->pending_chunk = 0;
+  state->pending_binary = false;
+}
+
+void *sender_main(void *arg) {
+  sender_data_t *data = (sender_data_t *)arg;
+  sender_state_t state;
+  sender_state_init(&state);
+
+  // HELLOs and the liveness check keep their own deadline, a
+  // paced DV round only fills the time in between
+  auto next_round = std::chrono::steady_clock::now();
+  bool pending = false;
+  while (true) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_round) {
+      pending = sender_tick(data, &state, send_socket, data);
+      next_round += std::chrono::seconds(SEND_INTERVAL_SEC);
+    } else if (pending) {
+      pending = sender_pace(data, &state, send_socket, data);
+    }
 
-    sn++;
-    dv_counter++;
-    std::this_thread::sleep_for(std::chrono::seconds(5));
+    auto wake = next_round;
+    if (pending) {
+      wake = std::min(wake, std::chrono::steady_clock::now() +
+                                std::chrono::milliseconds(DV_PACE_INTERVAL_MS));
+    }
+    std::this_thread::sleep_until(wake);
   }
 }
@@ -15,6 +15,44 @@ typedef struct sender_data_t {
   pthread_mutex_t *cout_mutex;
 } sender_data_t;
 
+// seconds between HELLO rounds, DVs go out with them
+#define SEND_INTERVAL_SEC 5
+
+// DV chunks sent back to back, then the sender waits
+// DV_PACE_INTERVAL_MS before the next burst
+#define DV_PACE_BURST 16
+#define DV_PACE_INTERVAL_MS 5
+
+typedef struct sender_state_t {
+  uint16_t sn;
+  uint16_t dv_counter;
+  // last DV bodies sent in each format, kept until the table changes
+  dv_encoding_t dv_text;
+  dv_encoding_t dv_binary;
+  // DV round still being paced out: the snapshot it sends, the
+  // interface and chunk sent next and that interface's format
+  dv_snapshot_t *pending;
+  uint16_t pending_iface;
+  size_t pending_chunk;
+  bool pending_binary;
+} sender_state_t;
+
+// sends one datagram gathered from iov out of interface i
+typedef ssize_t (*sender_send_fn)(void *ctx, uint16_t i,
+                                  const struct iovec *iov, size_t iov_count,
+                                  struct sockaddr_in *dest_addr);
+
+void sender_state_init(sender_state_t *state);
+
+// one liveness check and HELLO/DV round, true while DV chunks
+// are left for sender_pace
+bool sender_tick(sender_data_t *data, sender_state_t *state,
+                 sender_send_fn send, void *ctx);
+
+// sends the next burst of DV chunks, true while more are left
+bool sender_pace(sender_data_t *data, sender_state_t *state,
+                 sender_send_fn send, void *ctx);
+
 void *sender_main(void *arg);
 
 #endif
@@ -0,0 +1,560 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "uring.h"
+
+// raw syscalls, the io_uring ABI is taken from the kernel headers
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                       unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg,
+                          unsigned nr_args) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_close(uring_t *ring) {
+  if (ring->sqes) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  }
+  if (ring->sq_ring) {
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+}
+
+// ring mapping as described in io_uring_setup(2)
+static bool uring_open(uring_t *ring, unsigned entries) {
+  memset(ring, 0, sizeof(*ring));
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = uring_setup(entries, &params);
+  if (ring->fd < 0) {
+    return false;
+  }
+
+  ring->sq_ring_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+      ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+
+  void *sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    uring_close(ring);
+    return false;
+  }
+  ring->sq_ring = sq_ring;
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ring = sq_ring;
+  } else {
+    void *cq_ring =
+        mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      uring_close(ring);
+      return false;
+    }
+    ring->cq_ring = cq_ring;
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    uring_close(ring);
+    return false;
+  }
+  ring->sqes = (struct io_uring_sqe *)sqes;
+
+  char *sq = (char *)ring->sq_ring;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_entries = params.sq_entries;
+  ring->sqe_tail = *ring->sq_tail;
+
+  // sqes are always used in ring order
+  unsigned *array = (unsigned *)(sq + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; i++) {
+    array[i] = i;
+  }
+
+  char *cq = (char *)ring->cq_ring;
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return true;
+}
+
+// publishes filled sqes and optionally waits for completions
+static int uring_submit(uring_t *ring, unsigned wait_nr) {
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+  unsigned to_submit =
+      ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (to_submit == 0 && wait_nr == 0) {
+    return 0;
+  }
+  return uring_enter(ring->fd, to_submit, wait_nr,
+                     wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+// next free sqe, submitting what is queued when the ring is full
+static struct io_uring_sqe *uring_get_sqe(uring_t *ring) {
+  while (ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+         ring->sq_entries) {
+    if (uring_submit(ring, 0) < 0 && errno != EINTR && errno != EBUSY) {
+      return NULL;
+    }
+  }
+  struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sqe_tail++;
+  return sqe;
+}
+
+static uint64_t uring_tag(void *ptr, uint64_t op) {
+  return (uint64_t)(uintptr_t)ptr | op;
+}
+
+// hands receive buffer bid back to the kernel
+static void uring_buf_recycle(uring_loop_t *loop, uint16_t bid) {
+  // indexed by hand, in C++ the header's flex array member sits
+  // behind an empty struct and lands 8 bytes past the ring start
+  struct io_uring_buf *bufs = (struct io_uring_buf *)loop->buf_ring;
+  struct io_uring_buf *buf = &bufs[loop->buf_tail & (URING_BUF_COUNT - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(loop->bufs + bid * loop->buf_size);
+  buf->len = loop->buf_size;
+  buf->bid = bid;
+  loop->buf_tail++;
+  __atomic_store_n(&loop->buf_ring->tail, loop->buf_tail, __ATOMIC_RELEASE);
+}
+
+// provided buffer ring, each buffer holds the io_uring_recvmsg_out
+// header, the sender address, ancillary data and the payload
+static bool uring_bufs_init(uring_loop_t *loop) {
+  loop->buf_ring_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+  void *buf_ring = mmap(NULL, loop->buf_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf_ring == MAP_FAILED) {
+    return false;
+  }
+  loop->buf_ring = (struct io_uring_buf_ring *)buf_ring;
+  loop->buf_tail = 0;
+
+  loop->buf_size = sizeof(struct io_uring_recvmsg_out) +
+                   sizeof(struct sockaddr_in) + RECV_CONTROL_LEN +
+                   REC_BUFF_SIZE;
+  loop->bufs = (char *)malloc(URING_BUF_COUNT * loop->buf_size);
+  if (!loop->bufs) {
+    munmap(buf_ring, loop->buf_ring_size);
+    return false;
+  }
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)buf_ring;
+  reg.ring_entries = URING_BUF_COUNT;
+  reg.bgid = URING_BUF_GROUP;
+  if (uring_register(loop->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    free(loop->bufs);
+    munmap(buf_ring, loop->buf_ring_size);
+    return false;
+  }
+
+  for (uint16_t bid = 0; bid < URING_BUF_COUNT; bid++) {
+    uring_buf_recycle(loop, bid);
+  }
+  return true;
+}
+
+static void uring_arm_recv(uring_loop_t *loop, uring_recv_t *recv) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+  if (!sqe) {
+    return;
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = recv->socket->fd;
+  sqe->len = 1;
+  sqe->user_data = uring_tag(recv, URING_OP_RECV);
+  if (recv->oneshot) {
+    // name and control land in the header, the payload in buf
+    recv->iov.iov_base = recv->buf;
+    recv->iov.iov_len = REC_BUFF_SIZE - 1;
+    memset(&recv->oneshot_hdr, 0, sizeof(recv->oneshot_hdr));
+    recv->oneshot_hdr.msg_name = &recv->addr;
+    recv->oneshot_hdr.msg_namelen = sizeof(recv->addr);
+    recv->oneshot_hdr.msg_iov = &recv->iov;
+    recv->oneshot_hdr.msg_iovlen = 1;
+    // the kernel may not write back the control length, so
+    // unused space must not read as a message
+    memset(recv->control, 0, sizeof(recv->control));
+    recv->oneshot_hdr.msg_control = recv->control;
+    recv->oneshot_hdr.msg_controllen = sizeof(recv->control);
+    sqe->addr = (uint64_t)(uintptr_t)&recv->oneshot_hdr;
+  } else {
+    sqe->addr = (uint64_t)(uintptr_t)&recv->hdr;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+  }
+  recv->armed = true;
+}
+
+// a failed receive is re-armed as a single shot recvmsg, a socket
+// that keeps failing is given up so it cannot spin the loop
+static void uring_recv_error(uring_recv_t *recv, int err) {
+  if (++recv->errors >= URING_RECV_ERRORS) {
+    LOG_ERROR("io_uring receive failed %d times in a row on %s: %s, "
+              "no longer reading it",
+              recv->errors, recv->socket->name, strerror(err));
+    recv->failed = true;
+    return;
+  }
+  if (!recv->oneshot) {
+    recv->buf = (char *)malloc(REC_BUFF_SIZE);
+    if (!recv->buf) {
+      recv->failed = true;
+      return;
+    }
+    recv->oneshot = true;
+    LOG_ERROR("io_uring receive failed on %s: %s, re-arming as single "
+              "shot recvmsg",
+              recv->socket->name, strerror(err));
+    return;
+  }
+  LOG_ERROR("io_uring receive failed on %s: %s", recv->socket->name,
+            strerror(err));
+}
+
+// hands one datagram to receive_datagram through a msg slot
+static void uring_deliver(uring_loop_t *loop, uring_recv_t *recv,
+                          const char *data, size_t n, struct msghdr *hdr) {
+  msg_slots_t *slots = loop->receiver->msg_queue->slots;
+  msg_queue_entry_t *entry = loop->spare ? loop->spare : msg_slot_take(slots);
+  loop->spare = NULL;
+  if (entry) {
+    memcpy(entry->msg_str, data, n);
+    loop->spare =
+        receive_datagram(loop->receiver, recv->socket, entry, n, hdr);
+    loop->stats.datagrams++;
+  } else {
+    // every slot is queued
+    __atomic_fetch_add(&slots->drops, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// a timer that could not be armed is retried by the main loop
+static bool uring_arm_timer(uring_loop_t *loop, uring_timer_t *timer) {
+  struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+  timer->armed = sqe != NULL;
+  if (!sqe) {
+    LOG_ERROR("io_uring timer not armed: %s", strerror(errno));
+    return false;
+  }
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (uint64_t)(uintptr_t)&timer->ts;
+  sqe->len = 1;
+  sqe->user_data = uring_tag(timer, URING_OP_TIMER);
+  return true;
+}
+
+// sender_send_fn queueing a sendmsg, sender_tick frees its buffers
+// on return so the message is copied into a pooled send first
+static ssize_t uring_send(void *ctx, uint16_t i, const struct iovec *iov,
+                          size_t iov_count, struct sockaddr_in *dest_addr) {
+  uring_loop_t *loop = (uring_loop_t *)ctx;
+  sender_data_t *sender = loop->sender;
+
+  size_t len = 0;
+  for (size_t j = 0; j < iov_count; j++) {
+    len += iov[j].iov_len;
+  }
+  // no receiver takes more than REC_BUFF_SIZE
+  if (len > sizeof(((uring_send_t *)NULL)->payload)) {
+    return -1;
+  }
+  uring_send_t *send = (uring_send_t *)slab_alloc(&loop->send_pool);
+  if (!send) {
+    return -1;
+  }
+  // gathered into one copy, the kernel reads it after we return
+  char *out = send->payload;
+  for (size_t j = 0; j < iov_count; j++) {
+    memcpy(out, iov[j].iov_base, iov[j].iov_len);
+    out += iov[j].iov_len;
+  }
+  send->dest_addr = *dest_addr;
+  send->iov.iov_base = send->payload;
+  send->iov.iov_len = len;
+
+  int fd = prepare_interface_msg(
+      &sender->sockets, i, &sender->interfaces.interfaces[i], &send->hdr,
+      &send->iov, 1, send->control, &send->dest_addr);
+
+  struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+  if (!sqe) {
+    slab_free(&loop->send_pool, send);
+    return -1;
+  }
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)(uintptr_t)&send->hdr;
+  sqe->len = 1;
+  sqe->user_data = uring_tag(send, URING_OP_SEND);
+
+  // the completion reports failures
+  return len;
+}
+
+// copies one received datagram into a msg slot for receive_datagram
+static void uring_complete_recv(uring_loop_t *loop, uring_recv_t *recv,
+                                struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    recv->armed = false;
+  }
+
+  if (cqe->res < 0) {
+    // out of buffers, re-armed once they are recycled
+    if (cqe->res != -ENOBUFS) {
+      uring_recv_error(recv, -cqe->res);
+    }
+    return;
+  }
+  recv->errors = 0;
+
+  if (recv->oneshot) {
+    size_t n = (size_t)cqe->res;
+    uring_deliver(loop, recv, recv->buf, n, &recv->oneshot_hdr);
+    return;
+  }
+  if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+    return;
+  }
+
+  uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+  char *buf = loop->bufs + bid * loop->buf_size;
+  struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+  size_t header =
+      sizeof(*out) + recv->hdr.msg_namelen + recv->hdr.msg_controllen;
+  size_t n = (size_t)cqe->res > header ? cqe->res - header : 0;
+  if (n > REC_BUFF_SIZE - 1) {
+    n = REC_BUFF_SIZE - 1;
+  }
+
+  struct msghdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_name = buf + sizeof(*out);
+  hdr.msg_namelen = out->namelen;
+  hdr.msg_control = buf + sizeof(*out) + recv->hdr.msg_namelen;
+  hdr.msg_controllen = out->controllen;
+  hdr.msg_flags = out->flags;
+
+  uring_deliver(loop, recv, buf + header, n, &hdr);
+  uring_buf_recycle(loop, bid);
+}
+
+static void uring_complete_send(uring_loop_t *loop, uring_send_t *send,
+                                struct io_uring_cqe *cqe) {
+  loop->stats.sends++;
+  if (cqe->res < 0) {
+    loop->stats.send_errors++;
+    LOG_DEBUG("io_uring send failed: %s", strerror(-cqe->res));
+  }
+  slab_free(&loop->send_pool, send);
+}
+
+// one pace timer at most, a HELLO round during a paced DV round
+// must not start a second one
+static void uring_arm_pace(uring_loop_t *loop, bool pending) {
+  loop->pace_pending = pending;
+  if (pending && !loop->pace_timer.armed) {
+    uring_arm_timer(loop, &loop->pace_timer);
+  }
+}
+
+static void uring_complete_timer(uring_loop_t *loop, uring_timer_t *timer) {
+  timer->armed = false;
+  if (timer == &loop->pace_timer) {
+    uring_arm_pace(loop, sender_pace(loop->sender, &loop->sender_state,
+                                     uring_send, loop));
+    return;
+  }
+  if (timer == &loop->send_timer) {
+    uring_arm_pace(loop, sender_tick(loop->sender, &loop->sender_state,
+                                     uring_send, loop));
+  } else {
+    router_housekeeping(loop->housekeeping);
+    // the loop thread also sends, its cpu time covers both
+    double cpu_sec = msg_queue_cpu_sec(loop->receiver->msg_queue);
+    LOG_DEBUG("io_uring: %zu wakeups, %zu completions, %zu datagrams, "
+              "%zu sends (%zu failed), %zu receive arms, %.2f us cpu per "
+              "datagram",
+              loop->stats.wakeups, loop->stats.completions,
+              loop->stats.datagrams, loop->stats.sends,
+              loop->stats.send_errors, loop->stats.rearms,
+              loop->stats.datagrams ? cpu_sec * 1e6 / loop->stats.datagrams
+                                    : 0.0);
+  }
+  uring_arm_timer(loop, timer);
+}
+
+static void uring_reap(uring_loop_t *loop) {
+  uring_t *ring = &loop->ring;
+  unsigned head = *ring->cq_head;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    void *ptr = (void *)(uintptr_t)(cqe->user_data & ~URING_OP_MASK);
+
+    switch (cqe->user_data & URING_OP_MASK) {
+    case URING_OP_RECV:
+      uring_complete_recv(loop, (uring_recv_t *)ptr, cqe);
+      break;
+    case URING_OP_SEND:
+      uring_complete_send(loop, (uring_send_t *)ptr, cqe);
+      break;
+    case URING_OP_TIMER:
+      uring_complete_timer(loop, (uring_timer_t *)ptr);
+      break;
+    }
+    loop->stats.completions++;
+
+    head++;
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  }
+}
+
+static bool uring_loop_init(uring_loop_t *loop, receiver_data_t *receiver,
+                            sender_data_t *sender,
+                            router_housekeeping_t *housekeeping) {
+  memset(loop, 0, sizeof(*loop));
+  loop->receiver = receiver;
+  loop->sender = sender;
+  loop->housekeeping = housekeeping;
+
+  if (!uring_open(&loop->ring, URING_ENTRIES)) {
+    return false;
+  }
+  if (!uring_bufs_init(loop)) {
+    uring_close(&loop->ring);
+    return false;
+  }
+
+  socket_list_t *sockets = &receiver->sockets;
+  loop->recvs = (uring_recv_t *)calloc(sockets->count, sizeof(*loop->recvs));
+  if (!loop->recvs) {
+    free(loop->bufs);
+    munmap(loop->buf_ring, loop->buf_ring_size);
+    uring_close(&loop->ring);
+    return false;
+  }
+  for (uint16_t i = 0; i < sockets->count; i++) {
+    if (sockets->sockets[i].fd < 0) {
+      continue;
+    }
+    uring_recv_t *recv = &loop->recvs[loop->recv_count++];
+    recv->socket = &sockets->sockets[i];
+    recv->hdr.msg_namelen = sizeof(struct sockaddr_in);
+    recv->hdr.msg_controllen = RECV_CONTROL_LEN;
+  }
+
+  sender_state_init(&loop->sender_state);
+  loop->send_timer.ts.tv_sec = SEND_INTERVAL_SEC;
+  loop->housekeeping_timer.ts.tv_sec = HOUSEKEEPING_INTERVAL_SEC;
+  loop->pace_timer.ts.tv_nsec = DV_PACE_INTERVAL_MS * 1000000L;
+  slab_pool_init(&loop->send_pool, sizeof(uring_send_t),
+                 URING_SEND_SLAB_COUNT);
+  return true;
+}
+
+void uring_main(receiver_data_t *receiver, sender_data_t *sender,
+                router_housekeeping_t *housekeeping) {
+  uring_loop_t *loop = (uring_loop_t *)malloc(sizeof(*loop));
+  if (!loop || !uring_loop_init(loop, receiver, sender, housekeeping)) {
+    LOG_WARN("io_uring unavailable (%s), using threads", strerror(errno));
+    free(loop);
+    return;
+  }
+  LOG_INFO("Running io_uring loop on %u sockets", loop->recv_count);
+  msg_queue_set_receiver(receiver->msg_queue);
+
+  // the threaded sender also sends before its first sleep
+  uring_arm_pace(loop,
+                 sender_tick(sender, &loop->sender_state, uring_send, loop));
+
+  while (true) {
+    for (uint16_t i = 0; i < loop->recv_count; i++) {
+      uring_recv_t *recv = &loop->recvs[i];
+      if (!recv->armed && !recv->failed) {
+        uring_arm_recv(loop, recv);
+        loop->stats.rearms++;
+      }
+    }
+    // armed here the first time, and again if a re-arm failed
+    if (!loop->send_timer.armed) {
+      uring_arm_timer(loop, &loop->send_timer);
+    }
+    if (!loop->housekeeping_timer.armed) {
+      uring_arm_timer(loop, &loop->housekeeping_timer);
+    }
+    if (loop->pace_pending && !loop->pace_timer.armed) {
+      uring_arm_timer(loop, &loop->pace_timer);
+    }
+
+    // queued sends and re-arms go in with the wait
+    if (uring_submit(&loop->ring, 1) < 0 && errno != EINTR) {
+      LOG_ERROR("io_uring_enter failed: %s, falling back to threads",
+                strerror(errno));
+      break;
+    }
+    loop->stats.wakeups++;
+    msg_queue_t *queue = receiver->msg_queue;
+    __atomic_store_n(&queue->wakeups, queue->wakeups + 1, __ATOMIC_RELAXED);
+    uring_reap(loop);
+  }
+
+  // closed first so the kernel is done with every buffer
+  uring_close(&loop->ring);
+  if (loop->spare) {
+    msg_slot_release(receiver->msg_queue->slots, loop->spare);
+  }
+  slab_pool_destroy(&loop->send_pool);
+  for (uint16_t i = 0; i < loop->recv_count; i++) {
+    free(loop->recvs[i].buf);
+  }
+  free(loop->recvs);
+  free(loop->bufs);
+  munmap(loop->buf_ring, loop->buf_ring_size);
+  free(loop);
+}
@@ -0,0 +1,140 @@
+#ifndef URING_H_INCLUDED
+#define URING_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+#include "pool.h"
+#include "receiver.h"
+#include "router.h"
+#include "sender.h"
+
+// submission queue depth, the completion queue gets twice this
+#define URING_ENTRIES 256
+
+// receive buffers handed to the kernel, a power of two
+#define URING_BUF_COUNT 128
+#define URING_BUF_GROUP 0
+
+// receive errors in a row before a socket is no longer read
+#define URING_RECV_ERRORS 8
+
+// send buffers carved per slab malloc
+#define URING_SEND_SLAB_COUNT 16
+
+// what a completion belongs to, kept in the low bits of user_data
+enum {
+  URING_OP_RECV = 1,
+  URING_OP_SEND = 2,
+  URING_OP_TIMER = 3,
+};
+#define URING_OP_MASK 7ULL
+
+// submission and completion rings mapped from an io_uring fd
+typedef struct uring_t {
+  int fd;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  // filled but not yet published to the kernel
+  unsigned sqe_tail;
+  struct io_uring_sqe *sqes;
+
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+} uring_t;
+
+// a multishot recvmsg on one socket, the header only
+// tells the kernel how much name and control to keep
+typedef struct uring_recv_t {
+  router_socket_t *socket;
+  struct msghdr hdr;
+  bool armed;
+  // after a receive error the socket is read by one single shot
+  // recvmsg at a time, into the buffer and header below
+  bool oneshot;
+  struct msghdr oneshot_hdr;
+  struct iovec iov;
+  struct sockaddr_in addr;
+  char control[RECV_CONTROL_LEN];
+  char *buf;
+  // errors in a row, the socket is given up after URING_RECV_ERRORS
+  int errors;
+  bool failed;
+} uring_recv_t;
+
+// a sendmsg in flight, the kernel reads it after sender_tick
+// returns, freed back to the send pool by its completion
+typedef struct uring_send_t {
+  struct msghdr hdr;
+  struct iovec iov;
+  struct sockaddr_in dest_addr;
+  char control[SEND_CONTROL_LEN];
+  char payload[REC_BUFF_SIZE];
+} uring_send_t;
+
+typedef struct uring_timer_t {
+  struct __kernel_timespec ts;
+  // cleared by the completion, or when no sqe could be had
+  bool armed;
+} uring_timer_t;
+
+// completions per wakeup show how much each io_uring_enter batched
+typedef struct uring_stats_t {
+  size_t wakeups;
+  size_t completions;
+  size_t datagrams;
+  size_t sends;
+  size_t send_errors;
+  size_t rearms;
+} uring_stats_t;
+
+typedef struct uring_loop_t {
+  uring_t ring;
+
+  receiver_data_t *receiver;
+  sender_data_t *sender;
+  router_housekeeping_t *housekeeping;
+  sender_state_t sender_state;
+
+  uring_recv_t *recvs;
+  uint16_t recv_count;
+
+  struct io_uring_buf_ring *buf_ring;
+  size_t buf_ring_size;
+  uint16_t buf_tail;
+  char *bufs;
+  size_t buf_size;
+  // slot kept for the next datagram when the last was not queued
+  msg_queue_entry_t *spare;
+
+  uring_timer_t send_timer;
+  uring_timer_t housekeeping_timer;
+  // armed only while a DV round has chunks left to pace out
+  uring_timer_t pace_timer;
+  // the last send round left chunks to pace out
+  bool pace_pending;
+
+  slab_pool_t send_pool;
+
+  uring_stats_t stats;
+} uring_loop_t;
+
+// runs receive, send and timers on the calling thread, returns
+// only if io_uring could not be set up or failed, the caller then
+// starts threads
+void uring_main(receiver_data_t *receiver, sender_data_t *sender,
+                router_housekeeping_t *housekeeping);
+
+#endif